@@ -1072,6 +1072,39 @@ AC_DEFINE(HAVE_STRUCT_DIRENT_D_INO)
 fi
 ])
 
+AC_DEFUN(BASH_STRUCT_DIRENT_D_TYPE,
+[AC_REQUIRE([AC_HEADER_DIRENT])
+AC_MSG_CHECKING(for struct dirent.d_type)
+AC_CACHE_VAL(bash_cv_dirent_has_d_type,
+[AC_TRY_COMPILE([
+#include <stdio.h>
+#include <sys/types.h>
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif /* HAVE_UNISTD_H */
+#if defined(HAVE_DIRENT_H)
+# include <dirent.h>
+#else
+# define dirent direct
+# ifdef HAVE_SYS_NDIR_H
+#  include <sys/ndir.h>
+# endif /* SYSNDIR */
+# ifdef HAVE_SYS_DIR_H
+#  include <sys/dir.h>
+# endif /* SYSDIR */
+# ifdef HAVE_NDIR_H
+#  include <ndir.h>
+# endif
+#endif /* HAVE_DIRENT_H */
+],[
+struct dirent d; int z; z = d.d_type;
+], bash_cv_dirent_has_d_type=yes, bash_cv_dirent_has_d_type=no)])
+AC_MSG_RESULT($bash_cv_dirent_has_d_type)
+if test $bash_cv_dirent_has_d_type = yes; then
+AC_DEFINE(HAVE_STRUCT_DIRENT_D_TYPE)
+fi
+])
+
 AC_DEFUN(BASH_STRUCT_DIRENT_D_FILENO,
 [AC_REQUIRE([AC_HEADER_DIRENT])
 AC_MSG_CHECKING(for struct dirent.d_fileno)
@@ -158,6 +158,11 @@ rl_callback_read_char ()
     rl_set_signals ();
 #endif
 
+  /* A key typed while completion matches are being generated cancels the
+     completion, unless the matches are ready. */
+  if (_rl_complete_async_pending () && _rl_complete_async_finish () == 0)
+    _rl_complete_async_cancel ();
+
   do
     {
       RL_CHECK_SIGNALS ();
@@ -297,11 +302,54 @@ rl_callback_read_char ()
   CALLBACK_READ_RETURN ();
 }
 
+/* Insert or display the completion matches generated since the last call
+   to rl_callback_read_char, if they're ready.  The application calls this
+   when the file descriptor rl_completion_async_fd returns is readable. */
+void
+rl_callback_read_completion ()
+{
+  int jcode;
+  static procenv_t olevel;
+
+  if (rl_linefunc == NULL)
+    return;
+
+  memcpy ((void *)olevel, (void *)_rl_top_level, sizeof (procenv_t));
+#if defined (HAVE_POSIX_SIGSETJMP)
+  jcode = sigsetjmp (_rl_top_level, 0);
+#else
+  jcode = setjmp (_rl_top_level);
+#endif
+  if (jcode)
+    {
+      (*rl_redisplay_function) ();
+      _rl_want_redisplay = 0;
+      memcpy ((void *)_rl_top_level, (void *)olevel, sizeof (procenv_t));
+      CALLBACK_READ_RETURN ();
+    }
+
+#if defined (HANDLE_SIGNALS)
+  if (rl_persistent_signal_handlers == 0)
+    rl_set_signals ();
+#endif
+
+  if (_rl_complete_async_finish ())
+    {
+      RL_CHECK_SIGNALS ();
+      (*rl_redisplay_function) ();
+      _rl_want_redisplay = 0;
+    }
+
+  memcpy ((void *)_rl_top_level, (void *)olevel, sizeof (procenv_t));
+  CALLBACK_READ_RETURN ();
+}
+
 /* Remove the handler, and make sure the terminal is in its normal state. */
 void
 rl_callback_handler_remove ()
 {
   rl_linefunc = NULL;
+  _rl_complete_async_cancel ();
   RL_UNSETSTATE (RL_STATE_CALLBACK);
   RL_CHECK_SIGNALS ();
   if (in_handler)
@@ -359,6 +407,7 @@ rl_callback_sigcleanup ()
   if (RL_ISSTATE (RL_STATE_CHARSEARCH))
     RL_UNSETSTATE (RL_STATE_CHARSEARCH);
 
+  _rl_complete_async_cancel ();
   _rl_callback_func = 0;
 }
 #endif
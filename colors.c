@@ -64,10 +64,32 @@
 #include "colors.h"
 
 static bool is_colored (enum indicator_no type);
+static bool color_needs_stat (mode_t ftype);
 static void restore_default_color (void);
+static COLOR_EXT_TYPE *find_color_ext (const char *name, size_t len);
 
 COLOR_EXT_TYPE *_rl_color_ext_list = 0;
 
+/* A hash table of the extensions in _rl_color_ext_list, so finding the
+   one a file name ends with doesn't mean comparing the name against
+   every extension.  Extensions are hashed from their last byte to their
+   first, so we can hash every suffix of a name in one pass.  ORDER is
+   the extension's position in the list; the earliest one wins. */
+struct color_ext_slot
+  {
+    COLOR_EXT_TYPE *ext;	/* NULL if the slot is empty */
+    size_t order;
+  };
+
+static struct color_ext_slot *color_ext_table;
+static size_t color_ext_table_mask;
+static size_t color_ext_maxlen;		/* length of the longest extension */
+static bool *color_ext_lengths;		/* which lengths there are */
+
+#define COLOR_EXT_HASH_INIT	2166136261U
+#define COLOR_EXT_HASH_STEP(h, c) \
+  (((h) ^ (unsigned char)(c)) * 16777619U)
+
 /* Output a color indicator (which may contain nulls).  */
 void
 _rl_put_indicator (const struct bin_str *ind) {
@@ -122,9 +144,123 @@ _rl_print_prefix_color (void)
     return 1;
 }
   
-/* Returns whether any color sequence was printed. */
+static struct color_ext_slot *
+color_ext_slot (unsigned int hash, const char *ext, size_t len)
+{
+  size_t i;
+  struct color_ext_slot *slot;
+
+  for (i = hash & color_ext_table_mask; ; i = (i + 1) & color_ext_table_mask)
+    {
+      slot = &color_ext_table[i];
+      if (slot->ext == NULL
+          || (slot->ext->ext.len == len
+              && memcmp (slot->ext->ext.string, ext, len) == 0))
+        return slot;
+    }
+}
+
+/* Build the hash table from _rl_color_ext_list.  This has to be called
+   whenever the list changes. */
+void
+_rl_compile_color_ext_list (void)
+{
+  COLOR_EXT_TYPE *ext;
+  struct color_ext_slot *slot;
+  size_t n, size, i;
+  unsigned int hash;
+
+  free (color_ext_table);
+  free (color_ext_lengths);
+  color_ext_table = NULL;
+  color_ext_lengths = NULL;
+  color_ext_table_mask = color_ext_maxlen = 0;
+
+  for (n = 0, ext = _rl_color_ext_list; ext != NULL; ext = ext->next, n++)
+    if (ext->ext.len > color_ext_maxlen)
+      color_ext_maxlen = ext->ext.len;
+  if (n == 0)
+    return;
+
+  for (size = 16; size < n * 2; size *= 2)
+    ;
+  color_ext_table = (struct color_ext_slot *)xmalloc (size * sizeof (struct color_ext_slot));
+  memset (color_ext_table, 0, size * sizeof (struct color_ext_slot));
+  color_ext_table_mask = size - 1;
+  color_ext_lengths = (bool *)xmalloc (color_ext_maxlen + 1);
+  memset (color_ext_lengths, 0, color_ext_maxlen + 1);
+
+  /* A later definition of the same extension is earlier in the list, and
+     overrides this one. */
+  for (n = 0, ext = _rl_color_ext_list; ext != NULL; ext = ext->next, n++)
+    {
+      hash = COLOR_EXT_HASH_INIT;
+      for (i = ext->ext.len; i > 0; i--)
+        hash = COLOR_EXT_HASH_STEP (hash, ext->ext.string[i - 1]);
+      slot = color_ext_slot (hash, ext->ext.string, ext->ext.len);
+      if (slot->ext == NULL)
+        {
+          slot->ext = ext;
+          slot->order = n;
+          color_ext_lengths[ext->ext.len] = true;
+        }
+    }
+}
+
+/* Return the extension in _rl_color_ext_list that NAME, of length LEN,
+   ends with, or NULL if there isn't one.  If it ends with more than one,
+   return the one that comes first in the list. */
+static COLOR_EXT_TYPE *
+find_color_ext (const char *name, size_t len)
+{
+  struct color_ext_slot *slot, *best;
+  unsigned int hash;
+  size_t i;
+
+  if (color_ext_table == NULL)
+    return NULL;
+
+  best = NULL;
+  hash = COLOR_EXT_HASH_INIT;
+  for (i = 0; i <= color_ext_maxlen && i <= len; i++)
+    {
+      if (i > 0)
+        hash = COLOR_EXT_HASH_STEP (hash, name[len - i]);
+      if (color_ext_lengths[i] == false)
+        continue;
+      slot = color_ext_slot (hash, name + len - i, i);
+      if (slot->ext && (best == NULL || slot->order < best->order))
+        best = slot;
+    }
+  return (best ? best->ext : NULL);
+}
+
+/* Return non-zero if the color of a file of type FTYPE (the S_IFMT bits
+   of its mode) can depend on the rest of its mode or its link count, so
+   we have to stat it. */
+static bool
+color_needs_stat (mode_t ftype)
+{
+  if (S_ISREG (ftype))
+    return (is_colored (C_SETUID) || is_colored (C_SETGID) ||
+	    is_colored (C_EXEC) || is_colored (C_MULTIHARDLINK));
+  else if (S_ISDIR (ftype))
+    return (is_colored (C_STICKY_OTHER_WRITABLE) ||
+	    is_colored (C_OTHER_WRITABLE) || is_colored (C_STICKY));
+#if defined (S_ISLNK)
+  else if (S_ISLNK (ftype))
+    return true;	/* need to know whether the link is dangling */
+#endif
+  else
+    return false;
+}
+
+/* Returns whether any color sequence was printed.  FTYPE, if non-zero, is
+   the type of file F is already known to be (the S_IFMT bits of its mode,
+   not following symbolic links); we use it instead of calling lstat if
+   that's all we need to choose the color. */
 bool
-_rl_print_color_indicator (const char *f)
+_rl_print_color_indicator (const char *f, mode_t ftype)
 {
   enum indicator_no colored_filetype;
   COLOR_EXT_TYPE *ext;	/* Color extension */
@@ -148,6 +284,12 @@ _rl_print_color_indicator (const char *f)
       name = filename;
     }
 
+  if (ftype && color_needs_stat (ftype) == false)
+    {
+      astat.st_mode = ftype;
+      stat_ok = 0;
+    }
+  else
 #if defined (HAVE_LSTAT)
   stat_ok = lstat(name, &astat);
 #else
@@ -247,14 +389,7 @@ _rl_print_color_indicator (const char *f)
     {
       /* Test if NAME has a recognized suffix.  */
       len = strlen (name);
-      name += len;		/* Pointer to final \0.  */
-      for (ext = _rl_color_ext_list; ext != NULL; ext = ext->next)
-        {
-          if (ext->ext.len <= len
-              && strncmp (name - ext->ext.len, ext->ext.string,
-                          ext->ext.len) == 0)
-            break;
-        }
+      ext = find_color_ext (name, len);
     }
 
   free (filename);	/* NULL or savestring return value */
@@ -120,7 +120,8 @@ enum filetype
 extern void _rl_put_indicator (const struct bin_str *ind);
 extern void _rl_set_normal_color (void);
 extern bool _rl_print_prefix_color (void);
-extern bool _rl_print_color_indicator (const char *f);
+extern bool _rl_print_color_indicator (const char *f, mode_t ftype);
 extern void _rl_prep_non_filename_text (void);
+extern void _rl_compile_color_ext_list (void);
 
 #endif /* !_COLORS_H_ */
@@ -65,6 +65,7 @@ extern int errno;
 /* System-specific feature definitions and include files. */
 #include "rldefs.h"
 #include "rlmbutil.h"
+#include "tcap.h"
 
 /* Some standard library routines. */
 #include "readline.h"
@@ -90,11 +91,237 @@ typedef int QSFUNC ();
 /* Unix version of a hidden file.  Could be different on other systems. */
 #define HIDDEN_FILE(fname)	((fname)[0] == '.')
 
-/* Most systems don't declare getpwent in <pwd.h> if _POSIX_SOURCE is
-   defined. */
-#if defined (HAVE_GETPWENT) && (!defined (HAVE_GETPW_DECLS) || defined (_POSIX_SOURCE))
-extern struct passwd *getpwent PARAMS((void));
-#endif /* HAVE_GETPWENT && (!HAVE_GETPW_DECLS || _POSIX_SOURCE) */
+/* If directory entries tell us the type of file, filename completion
+   remembers it so we don't have to stat each match to display it. */
+#if defined (HAVE_STRUCT_DIRENT_D_TYPE) && defined (DT_UNKNOWN)
+#  define MATCH_FILE_TYPES
+#endif
+
+#if defined (HAVE_PTHREAD_H) && defined (HAVE_PTHREAD_CREATE)
+#  define COMPLETION_THREADS
+#  include <pthread.h>
+#endif
+
+/* Completion matches can be generated on a separate thread while an
+   application using the callback interface goes on reading input. */
+#if defined (READLINE_CALLBACKS) && defined (COMPLETION_THREADS)
+#  define COMPLETION_ASYNC
+#endif
+
+/* Filename completion can expand wildcards in the directory name. */
+#if defined (HAVE_GLOB_H) && defined (HAVE_GLOB)
+#  define COMPLETION_GLOB
+#  include <glob.h>
+#endif
+
+/* Non-zero if FT, a file type from match_file_type, doesn't tell us
+   whether or not the file is a directory once symbolic links are
+   followed. */
+#if defined (S_ISLNK)
+#  define FTYPE_UNRESOLVED(ft)	((ft) == 0 || S_ISLNK (ft))
+#else
+#  define FTYPE_UNRESOLVED(ft)	((ft) == 0)
+#endif
+
+#if defined (MATCH_FILE_TYPES)
+/* What rl_filename_completion_function learned about the type of each
+   file it returned from the file's directory entry, so displaying and
+   inserting the matches doesn't have to stat every one.  This is a hash
+   table keyed on the match as returned, and it's emptied each time we
+   generate a new list of matches. */
+typedef struct _match_ftype {
+  char *match;		/* the match as returned; NULL if the slot is empty */
+  char *dname;		/* the directory entry's name, if the type is unknown */
+  int dir;		/* index into match_dirs */
+  mode_t type;		/* S_IFMT bits, or 0 if unknown */
+} MATCH_FTYPE;
+
+/* The directories the matches came from.  If a directory entry doesn't
+   say what type of file it is, we open the directory and use fstatat(2)
+   the first time someone asks. */
+typedef struct _match_dir {
+  char *path;
+  int fd;		/* -1 if not yet opened, -2 if open failed */
+} MATCH_DIR;
+#endif
+
+#if defined (COMPLETION_ASYNC)
+/* A request to generate matches on the completion thread.  The text and
+   the line are copies, since the application can change rl_line_buffer
+   while the matches are being generated. */
+typedef struct _async_completion {
+  char *text;
+  char *line;		/* rl_line_buffer when the request was made */
+  int start, end;
+  rl_compentry_func_t *func;
+  int found_quote, quote_char;
+  int delimiter, what_to_do;
+  char **matches;
+} ASYNC_COMPLETION;
+#endif
+
+/* What we need to know to display a match in a list of matches: the
+   part of it we print and how wide that is on the screen.  SPECIAL is
+   non-zero if it has characters that fnprint prints specially.  MATCH is
+   the match itself, so the entries can follow the matches when they're
+   sorted. */
+typedef struct _match_display {
+  char *match;
+  char *print;
+  int width;
+  int special;
+} MATCH_DISPLAY;
+
+/* What menu completion remembers about a match so that cycling through
+   the matches doesn't quote it or look it up in the file system each time
+   it's inserted.  QUOTED is the match as make_quoted_replacement quoted it
+   when the quoting character was IQC, and OQC is the quoting character it
+   left; QFREE is non-zero if QUOTED was allocated.  APPEND is what
+   match_append_type said to append after the match, or 0 if we don't
+   know yet. */
+typedef struct _menu_entry {
+  char *quoted;
+  int qfree;
+  char iqc, oqc;
+  int append;
+} MENU_ENTRY;
+
+/* A list of matches the user can scroll through and narrow by typing.
+   ORDER holds the indices of the matches sorted by KEYS, the text after
+   the prefix they have in common; the first I characters of FILTER
+   narrow the list to the part of ORDER from FIRST[I] up to LAST[I]. */
+typedef struct _match_pager {
+  char **matches;
+  MATCH_DISPLAY *info;
+  char **keys;
+  int *order;
+  char *filter;
+  int flen, fsize;
+  int *first, *last;
+  int max, sind, cols, height, top;
+} MATCH_PAGER;
+
+/* Commands read by the scrolling list of matches that aren't keys
+   typed to narrow it. */
+#define PAGER_NONE	0x100
+#define PAGER_QUIT	0x101
+#define PAGER_LINE_UP	0x102
+#define PAGER_LINE_DOWN	0x103
+#define PAGER_PAGE_UP	0x104
+#define PAGER_PAGE_DOWN	0x105
+#define PAGER_TOP	0x106
+#define PAGER_BOTTOM	0x107
+
+/* The number of slots initially allocated for a list of matches. */
+#define MATCH_LIST_INITIAL_SIZE	10
+
+/* Strings for the matches readline's own generators find are carved out
+   of a few large blocks rather than allocated one at a time, so reading a
+   directory with thousands of files doesn't mean thousands of calls to
+   malloc and free.  A string belongs to an arena if it lies within one of
+   the arena's blocks, so matches from the application's generators, which
+   are allocated as usual, can be in the same list.  Everything that
+   frees a match calls free_match, which frees the arena along with the
+   last of its strings.  Freeing the string just handed out, as happens to
+   the matches rl_completion_max_matches leaves out, gives its space back
+   to the arena, so the arena grows with the matches kept rather than
+   with all the generator returns. */
+typedef struct _arena_block {
+  struct _arena_block *next;
+  char *data;
+  size_t size, used;
+} ARENA_BLOCK;
+
+typedef struct _match_arena {
+  struct _match_arena *next;	/* in match_arenas */
+  ARENA_BLOCK *blocks;		/* most recently added first */
+  char *last;			/* the string most recently handed out */
+  int live;			/* strings handed out and not yet freed */
+  int filling;			/* non-zero while matches are being generated */
+} MATCH_ARENA;
+
+#define ARENA_BLOCK_SIZE	4096
+#define ARENA_BLOCK_MAX		(256 * 1024)
+
+/* The arena rl_filename_completion_function puts its matches in, if
+   any, and all the arenas with strings still in use. */
+static MATCH_ARENA *filling_arena = (MATCH_ARENA *)NULL;
+static MATCH_ARENA *match_arenas = (MATCH_ARENA *)NULL;
+
+#if defined (COMPLETION_THREADS)
+/* Matches can be freed on one thread while another generates more. */
+static pthread_mutex_t arena_lock = PTHREAD_MUTEX_INITIALIZER;
+#  define LOCK_ARENAS()		pthread_mutex_lock (&arena_lock)
+#  define UNLOCK_ARENAS()	pthread_mutex_unlock (&arena_lock)
+#else
+#  define LOCK_ARENAS()
+#  define UNLOCK_ARENAS()
+#endif
+
+/* A directory listing saved by the filename completion function, so that
+   completing again in the same directory doesn't have to read it again.
+   NAMES is sorted by bytes.  Each name is preceded in POOL by its
+   directory entry type (or 0 if we don't know it), so the two stay
+   together when NAMES is sorted.  When completion ignores case, FKEYS
+   holds each name folded the way FMODE says, and FORDER the indices of
+   the names sorted by their folded keys.  For fuzzy completion, CMASKS
+   holds a mask of the bytes in each name (or key, if CMODE says the
+   names were folded). */
+typedef struct _dir_listing {
+  char *path;		/* the directory name passed to opendir */
+  dev_t dev;		/* these identify the directory and its contents */
+  ino_t ino;
+  time_t mtime;
+  time_t ltime;		/* when we read the directory */
+  char **names;
+  int nnames;
+  char *pool;
+  unsigned long lastuse;
+  char **fkeys;
+  int *forder;
+  char *fpool;
+  int fmode;		/* FOLD_* flags, or 0 if not folded yet */
+  unsigned long *cmasks;
+  int cmode;		/* FOLD_* flags of the keys CMASKS describes */
+} DIR_LISTING;
+
+/* How the names in a directory listing are folded for comparison. */
+#define FOLD_CASE	0x01	/* ignore case */
+#define FOLD_MAP	0x02	/* treat `-' and `_' as the same */
+#define FOLD_MULTIBYTE	0x04	/* fold multibyte characters */
+#define FOLD_EXACT	0x08	/* not folded at all */
+
+/* The bit standing for byte C in a mask of the bytes a string contains.
+   Different bytes may share a bit, so a string can only contain the
+   bytes of another if its mask has all the other's bits set. */
+#define CHAR_MASK_BITS		(sizeof (unsigned long) * CHAR_BIT)
+#define CHAR_MASK_BIT(c)	(1UL << ((unsigned char)(c) % CHAR_MASK_BITS))
+
+/* The number of directory listings we keep. */
+#define DIR_CACHE_SIZE	8
+
+#define LISTING_NAME_TYPE(n)	((unsigned char)(n)[-1])
+
+#if defined (COMPLETION_GLOB)
+/* The directories a wildcarded directory name matches, which are read
+   in parallel.  Only the names in LISTINGS[i] between FIRST[i] and
+   LAST[i] can match the filename being completed. */
+typedef struct _dir_scan {
+  char **dirs;
+  int ndirs;
+  DIR_LISTING *listings;	/* path is NULL if the directory can't be read */
+  int *first, *last;
+  const char *prefix;		/* NULL means every name can match */
+  int prefix_len;
+#if defined (COMPLETION_THREADS)
+  pthread_mutex_t lock;		/* protects NEXT */
+#endif
+  int next;			/* the next directory to read */
+} DIR_SCAN;
+
+/* The most threads we use to read directories. */
+#define MAX_SCAN_THREADS	8
+#endif
 
 /* If non-zero, then this is the address of a function to call when
    completing a word would normally display the list of possible matches.
@@ -112,11 +339,11 @@ rl_compdisp_func_t *rl_completion_display_matches_hook = (rl_compdisp_func_t *)N
 #endif
 
 #if defined (VISIBLE_STATS)
-static int stat_char PARAMS((char *));
+static int stat_char PARAMS((char *, mode_t));
 #endif
 
 #if defined (COLOR_SUPPORT)
-static int colored_stat_start PARAMS((const char *));
+static int colored_stat_start PARAMS((const char *, mode_t));
 static void colored_stat_end PARAMS((void));
 static int colored_prefix_start PARAMS((void));
 static void colored_prefix_end PARAMS((void));
@@ -124,7 +351,90 @@ static void colored_prefix_end PARAMS((void));
 
 static int path_isdir PARAMS((const char *));
 
+static DIR_LISTING *get_dir_listing PARAMS((const char *));
+static int read_dir_listing PARAMS((DIR_LISTING *, const char *, struct stat *));
+static void free_dir_listing PARAMS((DIR_LISTING *));
+static int completion_fold_mode PARAMS((void));
+static int fold_completion_name PARAMS((const char *, int, char **, size_t *));
+static int fold_key_compare PARAMS((const void *, const void *));
+static void fold_dir_listing PARAMS((DIR_LISTING *, int));
+static int folded_lower_bound PARAMS((DIR_LISTING *, const char *, int));
+static unsigned long char_mask PARAMS((const char *));
+static void mask_dir_listing PARAMS((DIR_LISTING *, char **, int));
+static int fuzzy_char_len PARAMS((const char *, int));
+static int fuzzy_match_p PARAMS((const char *, const char *));
+static int fuzzy_score PARAMS((const char *, const char *));
+static int fuzzy_rank_compare PARAMS((const void *, const void *));
+static void rank_fuzzy_matches PARAMS((char **, int, const char *));
+static void keep_typed_text PARAMS((char **, const char *));
+static int dir_listing_lower_bound PARAMS((DIR_LISTING *, const char *, int));
+
+/* The pattern fuzzy filename completion matched, folded as FUZZY_FOLD
+   says, so the matches can be ranked once they're all found.  NULL if
+   the last completion wasn't fuzzy. */
+static char *fuzzy_pattern = (char *)NULL;
+static int fuzzy_fold;
+
+#if defined (COMPLETION_GLOB)
+static int glob_chars_p PARAMS((const char *));
+#if defined (MATCH_FILE_TYPES)
+static int mode_to_dtype PARAMS((mode_t));
+#endif
+static void scan_one_dir PARAMS((DIR_SCAN *, int));
+static void *dir_scan_worker PARAMS((void *));
+#if defined (COMPLETION_THREADS)
+static void *dir_scan_thread PARAMS((void *));
+#endif
+static void scan_dirs PARAMS((DIR_SCAN *));
+static int merge_dir_listings PARAMS((DIR_LISTING *, DIR_SCAN *));
+static DIR_LISTING *get_glob_listing PARAMS((const char *, const char *, int));
+#endif
+
+#if defined (MATCH_FILE_TYPES)
+static void clear_match_file_types PARAMS((void));
+static int add_match_dir PARAMS((const char *));
+static MATCH_FTYPE *match_ftype_slot PARAMS((const char *));
+static mode_t dtype_to_mode PARAMS((int));
+static void record_match_file_type PARAMS((const char *, const char *, int, int));
+static mode_t match_file_type PARAMS((const char *));
+#else
+#  define match_file_type(m)	((mode_t)0)
+#endif
+
+#if defined (COMPLETION_ASYNC)
+static int on_completion_thread PARAMS((void));
+static void *async_completion_thread PARAMS((void *));
+static int start_completion_thread PARAMS((void));
+static int queue_async_completion PARAMS((ASYNC_COMPLETION *));
+static void free_async_completion PARAMS((ASYNC_COMPLETION *));
+static void drain_async_pipe PARAMS((void));
+static void wait_for_async_completion PARAMS((void));
+
+/* Generators running on the completion thread are stopped by cancelling
+   the request rather than by a signal, and leave the signals to the
+   application's thread. */
+#  define COMPLETION_INTERRUPTED() \
+  (on_completion_thread () ? async_cancelled : RL_SIG_RECEIVED ())
+#  define COMPLETION_CHECK_SIGNALS() \
+  do { if (on_completion_thread () == 0) RL_CHECK_SIGNALS (); } while (0)
+/* The completion thread shares the completion state (the entry function's
+   flags, the directory cache, the file type table, and so on) with the
+   application's thread, so everything on the application's thread that
+   uses it first stops any completion the thread is running. */
+#  define COMPLETION_EXCLUSIVE() \
+  do { if (on_completion_thread () == 0) wait_for_async_completion (); } while (0)
+#else
+#  define on_completion_thread()	0
+#  define COMPLETION_INTERRUPTED()	RL_SIG_RECEIVED ()
+#  define COMPLETION_CHECK_SIGNALS()	RL_CHECK_SIGNALS ()
+#  define COMPLETION_EXCLUSIVE()
+#endif
+
 static char *rl_quote_filename PARAMS((char *, int, char *));
+static void set_char_class PARAMS((int, const char *));
+static int quoting_needed PARAMS((const char *, char *, int *));
+static char *quote_match_list PARAMS((char **, char *));
+static int scan_for_unclosed_quote PARAMS((int, int *, int *));
 
 static void _rl_complete_sigcleanup PARAMS((int, void *));
 
@@ -133,18 +443,59 @@ static int get_y_or_n PARAMS((int));
 static int _rl_internal_pager PARAMS((int));
 static char *printable_part PARAMS((char *));
 static int fnwidth PARAMS((const char *));
-static int fnprint PARAMS((const char *, int, const char *));
-static int print_filename PARAMS((char *, char *, int));
-
-static char **gen_completion_matches PARAMS((char *, int, int, rl_compentry_func_t *, int, int));
-
+static int fnspecial PARAMS((const char *));
+static int fnprint PARAMS((const char *, int, const char *, mode_t, int));
+static int print_filename PARAMS((char *, char *, int, int));
+static void pad_column PARAMS((int));
+static MATCH_DISPLAY *match_display_info PARAMS((char **, int, int *));
+static int match_display_compare PARAMS((const void *, const void *));
+static void sort_match_display PARAMS((char **, MATCH_DISPLAY *, int));
+static int match_list_layout PARAMS((char **, int *, int *));
+static void display_match_list_internal PARAMS((char **, MATCH_DISPLAY *, int, int));
+
+static int pager_key_compare PARAMS((const void *, const void *));
+static int pager_narrow PARAMS((MATCH_PAGER *, int));
+static void pager_draw PARAMS((MATCH_PAGER *, int));
+static int pager_read_key PARAMS((void));
+static int scroll_match_list PARAMS((char **, MATCH_DISPLAY *, int, int));
+
+static char **gen_completion_matches PARAMS((char *, int, int, rl_compentry_func_t *, int, int, const char *));
+static int complete_with_matches PARAMS((char **, char *, int, int, int, int, char *));
+
+static int mark_duplicate_matches PARAMS((char **, int, char *));
 static char **remove_duplicate_matches PARAMS((char **));
 static void insert_match PARAMS((char *, int, int, char *));
+static void insert_replacement PARAMS((char *, int, int, char *));
+static int match_append_type PARAMS((char *, int));
 static int append_to_match PARAMS((char *, int, int, int));
+static int append_type_to_match PARAMS((int, int, int));
+static void menu_insert_match PARAMS((MENU_ENTRY *, char *, int, int, char *));
+static void menu_append_to_match PARAMS((MENU_ENTRY *, char *, char *, int, int));
+static void menu_free_entries PARAMS((MENU_ENTRY *, int));
 static void insert_all_matches PARAMS((char **, int, char *));
 static int complete_fncmp PARAMS((const char *, int, const char *, int));
 static void display_matches PARAMS((char **));
 static int compute_lcd_of_matches PARAMS((char **, int, const char *));
+static int byte_prefix_length PARAMS((const char *, const char *, int, int));
+#if defined (HANDLE_MULTIBYTE)
+static int mb_char_boundary PARAMS((const char *, int));
+static int mb_fold_prefix_length PARAMS((const char *, const char *, int, int));
+#endif
+static char **completion_matches PARAMS((const char *, rl_compentry_func_t *, int));
+static MATCH_ARENA *new_match_arena PARAMS((void));
+static char *arena_alloc PARAMS((MATCH_ARENA *, size_t));
+static void free_arena_blocks PARAMS((MATCH_ARENA *));
+static void end_match_arena PARAMS((MATCH_ARENA *));
+static void free_match PARAMS((char *));
+static int hold_match PARAMS((char *));
+static void unpool_match_list PARAMS((char **));
+static char *match_alloc PARAMS((size_t));
+static char **grow_match_list PARAMS((char **, int *, int));
+static int completion_match_limit PARAMS((void));
+static void omit_match PARAMS((char **, int, char *, int *));
+static void save_completion_matches PARAMS((char **, const char *, int, rl_compentry_func_t *, const char *));
+static int narrow_completion_matches PARAMS((const char *, int, rl_compentry_func_t *, const char *, char ***));
+static char **finish_match_list PARAMS((char **, int, const char *));
 static int postprocess_matches PARAMS((char ***, int));
 static int complete_get_screenwidth PARAMS((void));
 
@@ -189,6 +540,19 @@ int _rl_completion_case_fold = 0;
   for completion. */
 int _rl_completion_case_map = 0;
 
+/* Non-zero means filename completion matches names containing the
+   characters typed in order, not just names beginning with them, and
+   ranks the matches by how well they match. */
+int _rl_fuzzy_completion = 0;
+
+/* Non-zero means the current list of matches has been ranked by how well
+   they match, so it shouldn't be sorted. */
+int _rl_completion_ranked = 0;
+
+/* Non-zero means the generator producing the current matches may return
+   matches that don't begin with the text being completed. */
+int _rl_completion_nonprefix = 0;
+
 /* If zero, don't match hidden files (filenames beginning with a `.' on
    Unix) when doing filename completion. */
 int _rl_match_hidden_files = 1;
@@ -264,6 +628,37 @@ rl_compentry_func_t *rl_completion_entry_function = (rl_compentry_func_t *)NULL;
    *rl_completion_entry_function (see above). */
 rl_compentry_func_t *rl_menu_completion_entry_function = (rl_compentry_func_t *)NULL;
 
+/* Non-zero means the completion entry function is monotonic: every match
+   it returns for TEXT begins with TEXT, and the matches it returns for a
+   longer TEXT are exactly the matches for the shorter one that begin with
+   the longer one.  Readline can then narrow the previous list of matches
+   when the user types more characters instead of calling the function
+   again. */
+int rl_completion_entry_monotonic = 0;
+
+/* Non-zero means that when the application is using the callback
+   interface, completion matches are generated on a separate thread, and
+   inserted or displayed when the application calls
+   rl_callback_read_completion.  A key typed in the meantime cancels the
+   completion.  Only rl_filename_completion_function is run on the
+   thread, so the filename hooks it calls must be thread-safe. */
+int rl_completion_async = 0;
+
+#if defined (COMPLETION_ASYNC)
+/* The completion thread takes requests from ASYNC_QUEUED one at a time,
+   and leaves the results in ASYNC_DONE.  It writes a byte to ASYNC_PIPE
+   when there are results, so applications can wait for them with
+   select(2). */
+static pthread_t async_thread;
+static int async_thread_started;	/* -1 means we couldn't start it */
+static pthread_mutex_t async_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t async_cond = PTHREAD_COND_INITIALIZER;
+static ASYNC_COMPLETION *async_queued, *async_running, *async_done;
+static volatile int async_cancelled;	/* the running request was cancelled */
+static volatile int async_nmatches;	/* matches the running request has found */
+static int async_pipe[2] = { -1, -1 };
+#endif
+
 /* Pointer to alternative function to create matches.
    Function is called with TEXT, START, and END.
    START and END are indices in RL_LINE_BUFFER saying what the boundaries
@@ -288,8 +683,29 @@ int rl_completion_type = 0;
    don't ask. */
 int rl_completion_query_items = 100;
 
+/* If positive, rl_completion_matches keeps at most this many matches and
+   only counts the rest, so memory use stays bounded when the generator
+   finds a huge number of matches.  Values less than 2 are treated as 2. */
+int rl_completion_max_matches = 0;
+
+/* The number of matches the last list of matches generated left out
+   because of rl_completion_max_matches.  The matches left out aren't
+   kept, so duplicates among them can't be removed, and this is an upper
+   bound if the generator returns the same match more than once. */
+int rl_completion_matches_omitted = 0;
+
+/* Non-zero while rl_attempted_completion_function is running.  The lists
+   of matches it asks for are usually combined into the one it returns,
+   so their omitted counts add up rather than each replacing the last. */
+static int completion_attempt_depth = 0;
+
 int _rl_page_completions = 1;
 
+/* Non-zero means a list of matches too long for the screen is shown a
+   screenful at a time, and the user can scroll back and forth through it
+   and narrow it by typing. */
+int _rl_scroll_completions = 0;
+
 /* The basic list of characters that signal a break between words for the
    completer routine.  The contents of this variable is what breaks words
    in the shell, i.e. " \t\n\"\\'`@$><=" */
@@ -524,6 +940,7 @@ set_completion_defaults (what_to_do)
 
   /* Reset private state. */
   _rl_complete_display_matches_interrupt = 0;
+  _rl_completion_ranked = 0;
 }
 
 /* The user must press "y" or "n". Non-zero return means "y" pressed. */
@@ -596,10 +1013,14 @@ path_isdir (filename)
      `=' for sockets
      `|' for FIFOs
      `%' for character special devices
-     `#' for block special devices */
+     `#' for block special devices
+   FTYPE, if non-zero, is the type of file FILENAME is already known to be
+   (the S_IFMT bits of its mode, not following symbolic links), so we
+   don't need to stat it. */
 static int
-stat_char (filename)
+stat_char (filename, ftype)
      char *filename;
+     mode_t ftype;
 {
   struct stat finfo;
   int character, r;
@@ -623,6 +1044,12 @@ stat_char (filename)
   else
     fn = filename;
     
+  if (ftype)
+    {
+      finfo.st_mode = ftype;
+      r = 0;
+    }
+  else
 #if defined (HAVE_LSTAT) && defined (S_ISLNK)
   r = lstat (fn, &finfo);
 #else
@@ -680,11 +1107,12 @@ stat_char (filename)
 
 #if defined (COLOR_SUPPORT)
 static int
-colored_stat_start (filename)
+colored_stat_start (filename, ftype)
      const char *filename;
+     mode_t ftype;
 {
   _rl_set_normal_color ();
-  return (_rl_print_color_indicator (filename));
+  return (_rl_print_color_indicator (filename, ftype));
 }
 
 static void
@@ -802,13 +1230,32 @@ fnwidth (string)
   return width;
 }
 
+/* Return non-zero if STRING has characters fnprint doesn't print as
+   themselves. */
+static int
+fnspecial (string)
+     const char *string;
+{
+  register const char *s;
+
+  for (s = string; *s; s++)
+    if (CTRL_CHAR (*s) || *s == RUBOUT)
+      return 1;
+  return 0;
+}
+
 #define ELLIPSIS_LEN	3
 
+/* Print TO_PRINT and return its width on the screen.  WIDTH, if not -1,
+   is that width, already computed by fnwidth, and TO_PRINT has no
+   characters fnprint prints specially. */
 static int
-fnprint (to_print, prefix_bytes, real_pathname)
+fnprint (to_print, prefix_bytes, real_pathname, ftype, width)
      const char *to_print;
      int prefix_bytes;
      const char *real_pathname;
+     mode_t ftype;
+     int width;
 {
   int printed_len, w;
   const char *s;
@@ -817,10 +1264,12 @@ fnprint (to_print, prefix_bytes, real_pathname)
   mbstate_t ps;
   const char *end;
   size_t tlen;
-  int width;
+  int cwidth;
   wchar_t wc;
+#endif
 
   print_len = strlen (to_print);
+#if defined (HANDLE_MULTIBYTE)
   end = to_print + print_len + 1;
   memset (&ps, 0, sizeof (mbstate_t));
 #endif
@@ -836,7 +1285,7 @@ fnprint (to_print, prefix_bytes, real_pathname)
 
 #if defined (COLOR_SUPPORT)
   if (_rl_colored_stats && (prefix_bytes == 0 || _rl_colored_completion_prefix <= 0))
-    colored_stat_start (real_pathname);
+    colored_stat_start (real_pathname, ftype);
 #endif
 
   if (prefix_bytes && _rl_completion_prefix_display_length > 0)
@@ -858,7 +1307,16 @@ fnprint (to_print, prefix_bytes, real_pathname)
     }
 #endif
 
-  s = to_print + prefix_bytes;
+  /* If we know how wide the whole string is, and we're not doing anything
+     special with a prefix, we can print it all at once. */
+  if (width >= 0 && prefix_bytes == 0 && common_prefix_len == 0)
+    {
+      fwrite (to_print, 1, print_len, rl_outstream);
+      printed_len += width;
+      s = to_print + print_len;
+    }
+  else
+    s = to_print + prefix_bytes;
   while (*s)
     {
       if (CTRL_CHAR (*s))
@@ -888,7 +1346,7 @@ fnprint (to_print, prefix_bytes, real_pathname)
 	  if (MB_INVALIDCH (tlen))
 	    {
 	      tlen = 1;
-	      width = 1;
+	      cwidth = 1;
 	      memset (&ps, 0, sizeof (mbstate_t));
 	    }
 	  else if (MB_NULLWCH (tlen))
@@ -896,11 +1354,11 @@ fnprint (to_print, prefix_bytes, real_pathname)
 	  else
 	    {
 	      w = WCWIDTH (wc);
-	      width = (w >= 0) ? w : 1;
+	      cwidth = (w >= 0) ? w : 1;
 	    }
 	  fwrite (s, 1, tlen, rl_outstream);
 	  s += tlen;
-	  printed_len += width;
+	  printed_len += cwidth;
 #else
 	  putc (*s, rl_outstream);
 	  s++;
@@ -914,7 +1372,7 @@ fnprint (to_print, prefix_bytes, real_pathname)
 	  /* printed bytes should never be > but check for paranoia's sake */
 	  colored_prefix_end ();
 	  if (_rl_colored_stats)
-	    colored_stat_start (real_pathname);		/* XXX - experiment */
+	    colored_stat_start (real_pathname, ftype);	/* XXX - experiment */
 #endif
 	  common_prefix_len = 0;
 	}
@@ -931,22 +1389,24 @@ fnprint (to_print, prefix_bytes, real_pathname)
 
 /* Output TO_PRINT to rl_outstream.  If VISIBLE_STATS is defined and we
    are using it, check for and output a single character for `special'
-   filenames.  Return the number of characters we output. */
+   filenames.  Return the number of characters we output.  WIDTH is as
+   for fnprint. */
 
 static int
-print_filename (to_print, full_pathname, prefix_bytes)
+print_filename (to_print, full_pathname, prefix_bytes, width)
      char *to_print, *full_pathname;
-     int prefix_bytes;
+     int prefix_bytes, width;
 {
   int printed_len, extension_char, slen, tlen;
   char *s, c, *new_full_pathname, *dn;
+  mode_t ftype;
 
   extension_char = 0;
 #if defined (COLOR_SUPPORT)
   /* Defer printing if we want to prefix with a color indicator */
   if (_rl_colored_stats == 0 || rl_filename_completion_desired == 0)
 #endif
-    printed_len = fnprint (to_print, prefix_bytes, to_print);
+    printed_len = fnprint (to_print, prefix_bytes, to_print, 0, width);
 
   if (rl_filename_completion_desired && (
 #if defined (VISIBLE_STATS)
@@ -957,6 +1417,10 @@ print_filename (to_print, full_pathname, prefix_bytes)
 #endif
      _rl_complete_mark_directories))
     {
+      /* If the filename completion function told us what type of file
+	 this is, we can avoid most of the work below. */
+      ftype = match_file_type (full_pathname);
+
       /* If to_print != full_pathname, to_print is the basename of the
 	 path passed.  In this case, we try to expand the directory
 	 name before checking for the stat character. */
@@ -998,10 +1462,12 @@ print_filename (to_print, full_pathname, prefix_bytes)
 
 #if defined (VISIBLE_STATS)
 	  if (rl_visible_stats)
-	    extension_char = stat_char (new_full_pathname);
+	    extension_char = stat_char (new_full_pathname, ftype);
 	  else
 #endif
-	  if (_rl_complete_mark_directories)
+	  if (_rl_complete_mark_directories && S_ISDIR (ftype))
+	    extension_char = '/';
+	  else if (_rl_complete_mark_directories && FTYPE_UNRESOLVED (ftype))
 	    {
 	      dn = 0;
 	      if (rl_directory_completion_hook == 0 && rl_filename_stat_hook)
@@ -1018,7 +1484,7 @@ print_filename (to_print, full_pathname, prefix_bytes)
 	  /* Move colored-stats code inside fnprint() */
 #if defined (COLOR_SUPPORT)
 	  if (_rl_colored_stats)
-	    printed_len = fnprint (to_print, prefix_bytes, new_full_pathname);
+	    printed_len = fnprint (to_print, prefix_bytes, new_full_pathname, ftype, width);
 #endif
 
 	  xfree (new_full_pathname);
@@ -1029,16 +1495,17 @@ print_filename (to_print, full_pathname, prefix_bytes)
 	  s = tilde_expand (full_pathname);
 #if defined (VISIBLE_STATS)
 	  if (rl_visible_stats)
-	    extension_char = stat_char (s);
+	    extension_char = stat_char (s, ftype);
 	  else
 #endif
-	    if (_rl_complete_mark_directories && path_isdir (s))
+	    if (_rl_complete_mark_directories &&
+		(S_ISDIR (ftype) || (FTYPE_UNRESOLVED (ftype) && path_isdir (s))))
 	      extension_char = '/';
 
 	  /* Move colored-stats code inside fnprint() */
 #if defined (COLOR_SUPPORT)
 	  if (_rl_colored_stats)
-	    printed_len = fnprint (to_print, prefix_bytes, s);
+	    printed_len = fnprint (to_print, prefix_bytes, s, ftype, width);
 #endif
 	}
 
@@ -1053,6 +1520,91 @@ print_filename (to_print, full_pathname, prefix_bytes)
   return printed_len;
 }
 
+/* The character sets the completion code tests characters against, as
+   indexes into char_class_sets.  Each gets a bit in char_class_table. */
+#define CC_FILENAME_QUOTE	0	/* rl_filename_quote_characters */
+#define CC_WORD_BREAK		1	/* the word break characters */
+#define CC_COMPLETER_QUOTE	2	/* rl_completer_quote_characters */
+#define CC_NCLASSES		3
+
+#define CHAR_CLASS_P(c, cls) \
+  (char_class_table[(unsigned char)(c)] & (1 << (cls)))
+
+/* The members of each set are looked up in this table instead of with
+   strchr.  Applications may point the variables at new strings or
+   change the strings in place at any time, so each class remembers a
+   copy of the set it was built from and set_char_class rebuilds it when
+   the set no longer matches.  The generation number changes each time a
+   class is rebuilt. */
+static unsigned char char_class_table[256];
+
+static struct {
+  char *copy;
+  int generation;
+} char_class_sets[CC_NCLASSES];
+
+/* Make class CLS of char_class_table hold the characters in CHARS, which
+   may be NULL. */
+static void
+set_char_class (cls, chars)
+     int cls;
+     const char *chars;
+{
+  register int i;
+  const unsigned char *s;
+
+  if (chars ? (char_class_sets[cls].copy && STREQ (char_class_sets[cls].copy, chars))
+	    : char_class_sets[cls].copy == 0)
+    return;
+
+  for (i = 0; i < 256; i++)
+    char_class_table[i] &= ~(1 << cls);
+  for (s = (const unsigned char *)chars; s && *s; s++)
+    char_class_table[*s] |= 1 << cls;
+
+  FREE (char_class_sets[cls].copy);
+  char_class_sets[cls].copy = chars ? savestring (chars) : (char *)NULL;
+  char_class_sets[cls].generation++;
+}
+
+/* Return non-zero if MATCH should be passed to the filename quoting
+   function before it's inserted; QC points to the quote character in
+   effect, if any.  If LENP is non-null, it gets the length of MATCH,
+   which is found by the same scan. */
+static int
+quoting_needed (match, qc, lenp)
+     const char *match;
+     char *qc;
+     int *lenp;
+{
+  register const char *s;
+  int should_quote;
+
+  should_quote = match && rl_completer_quote_characters &&
+			rl_filename_completion_desired &&
+			rl_filename_quoting_desired &&
+			rl_filename_quote_characters;
+
+  if (should_quote && qc && *qc)
+    {
+      set_char_class (CC_COMPLETER_QUOTE, rl_completer_quote_characters);
+      should_quote = CHAR_CLASS_P (*qc, CC_COMPLETER_QUOTE) != 0;
+    }
+
+  s = match;
+  if (should_quote)
+    {
+      set_char_class (CC_FILENAME_QUOTE, rl_filename_quote_characters);
+      for ( ; *s && CHAR_CLASS_P (*s, CC_FILENAME_QUOTE) == 0; s++)
+	;
+      should_quote = *s != '\0';
+    }
+
+  if (lenp)
+    *lenp = match ? (s - match) + strlen (s) : 0;
+  return (should_quote);
+}
+
 static char *
 rl_quote_filename (s, rtype, qcp)
      char *s;
@@ -1060,15 +1612,193 @@ rl_quote_filename (s, rtype, qcp)
      char *qcp;
 {
   char *r;
+  int len;
 
-  r = (char *)xmalloc (strlen (s) + 2);
+  len = strlen (s);
+  r = (char *)xmalloc (len + 2);
   *r = *rl_completer_quote_characters;
-  strcpy (r + 1, s);
+  memcpy (r + 1, s, len + 1);
   if (qcp)
     *qcp = *rl_completer_quote_characters;
   return r;
 }
 
+/* The state of the scan for an unclosed quoted substring just before
+   the character at offset POS in the line. */
+typedef struct {
+  int pos;
+  int pass_next;
+  int found_quote;
+  int quote_start;	/* first character of the quoted substring */
+  int quote_char;	/* the quote that opened it, or '\0' */
+#if defined (HANDLE_MULTIBYTE)
+  mbstate_t ps;
+#endif
+} QUOTE_SCAN_STATE;
+
+/* How far apart (in bytes) the saved scan states are. */
+#define QUOTE_SCAN_INTERVAL	128
+
+/* States saved by earlier scans, so that completing in a long line only
+   rescans from the last state before the first byte that changed.  LINE
+   is a copy of the line (with its terminating null) when it was last
+   scanned; comparing against it finds the changes however they were
+   made.  The states are only good for the set of quote characters and
+   the multibyte mode they were taken with. */
+static struct {
+  char *line;
+  int len, size;
+  QUOTE_SCAN_STATE *states;
+  int nstates, ssize;
+  int generation;
+  int multibyte;
+} quote_scan;
+
+/* Scan the line from the start to END for an unclosed quoted substring,
+   as described below for _rl_find_completion_word, resuming from a saved
+   state when possible.  Returns the opening quote character, or '\0' if
+   there is no unclosed substring.  *STARTP gets the offset of the
+   substring's first character (END if there isn't one) and *FOUNDP the
+   kinds of quote characters found. */
+static int
+scan_for_unclosed_quote (end, startp, foundp)
+     int end, *startp, *foundp;
+{
+  QUOTE_SCAN_STATE st;
+  int scan, next, same, valid, last, len, i, mb;
+#if defined (HANDLE_MULTIBYTE)
+  size_t n;
+#endif
+  char c;
+
+  set_char_class (CC_COMPLETER_QUOTE, rl_completer_quote_characters);
+  mb = 0;
+#if defined (HANDLE_MULTIBYTE)
+  mb = MB_CUR_MAX > 1 && rl_byte_oriented == 0;
+#endif
+  len = rl_end + 1;
+
+  /* Find how much of the line is unchanged since the last scan. */
+  same = 0;
+  if (quote_scan.generation == char_class_sets[CC_COMPLETER_QUOTE].generation &&
+	quote_scan.multibyte == mb)
+    {
+      i = (len < quote_scan.len) ? len : quote_scan.len;
+      while (same < i && quote_scan.line[same] == rl_line_buffer[same])
+	same++;
+    }
+  else
+    quote_scan.nstates = 0;
+
+  /* A saved state is still good if none of the bytes that went into it
+     changed.  Finding the length of a multibyte character can look at
+     bytes past its end. */
+  valid = mb ? same - MB_CUR_MAX : same;
+  while (quote_scan.nstates > 0 && quote_scan.states[quote_scan.nstates - 1].pos > valid)
+    quote_scan.nstates--;
+
+  if (len > quote_scan.size)
+    {
+      quote_scan.size = len + QUOTE_SCAN_INTERVAL;
+      quote_scan.line = (char *)xrealloc (quote_scan.line, quote_scan.size);
+    }
+  memcpy (quote_scan.line + same, rl_line_buffer + same, len - same);
+  quote_scan.len = len;
+  quote_scan.generation = char_class_sets[CC_COMPLETER_QUOTE].generation;
+  quote_scan.multibyte = mb;
+
+  /* Start from the last good state before END.  States past END stay
+     saved; the line there hasn't changed. */
+  for (i = quote_scan.nstates; i > 0 && quote_scan.states[i - 1].pos > end; i--)
+    ;
+  if (i > 0)
+    st = quote_scan.states[i - 1];
+  else
+    {
+      st.pos = st.pass_next = st.found_quote = st.quote_char = 0;
+      st.quote_start = end;
+#if defined (HANDLE_MULTIBYTE)
+      memset (&st.ps, 0, sizeof (mbstate_t));
+#endif
+    }
+  last = quote_scan.nstates ? quote_scan.states[quote_scan.nstates - 1].pos : 0;
+
+  for (scan = st.pos; scan < end; scan = next)
+    {
+      if (scan - last >= QUOTE_SCAN_INTERVAL)
+	{
+	  if (quote_scan.nstates >= quote_scan.ssize)
+	    {
+	      quote_scan.ssize = quote_scan.ssize ? quote_scan.ssize * 2 : 16;
+	      quote_scan.states = (QUOTE_SCAN_STATE *)xrealloc (quote_scan.states, quote_scan.ssize * sizeof (QUOTE_SCAN_STATE));
+	    }
+	  st.pos = last = scan;
+	  quote_scan.states[quote_scan.nstates++] = st;
+	}
+
+      /* Step over a character at a time.  MB_NEXTCHAR would find the
+	 character boundary by rescanning the line from the start. */
+      next = scan + 1;
+#if defined (HANDLE_MULTIBYTE)
+      if (mb)
+	{
+	  n = mbrlen (rl_line_buffer + scan, rl_end - scan, &st.ps);
+	  if (MB_INVALIDCH (n))
+	    memset (&st.ps, 0, sizeof (mbstate_t));
+	  else if (n > 1)
+	    next = scan + n;
+	}
+#endif
+
+      if (st.pass_next)
+	{
+	  st.pass_next = 0;
+	  continue;
+	}
+
+      c = rl_line_buffer[scan];
+
+      /* Shell-like semantics for single quotes -- don't allow backslash
+	 to quote anything in single quotes, especially not the closing
+	 quote.  If you don't like this, take out the check on the value
+	 of quote_char. */
+      if (st.quote_char != '\'' && c == '\\')
+	{
+	  st.pass_next = 1;
+	  st.found_quote |= RL_QF_BACKSLASH;
+	  continue;
+	}
+
+      if (st.quote_char != '\0')
+	{
+	  /* Ignore everything until the matching close quote char. */
+	  if (c == st.quote_char)
+	    {
+	      /* Found matching close.  Abandon this substring. */
+	      st.quote_char = '\0';
+	      st.quote_start = end;
+	    }
+	}
+      else if (CHAR_CLASS_P (c, CC_COMPLETER_QUOTE))
+	{
+	  /* Found start of a quoted substring. */
+	  st.quote_char = c;
+	  st.quote_start = scan + 1;
+	  /* Shell-like quoting conventions. */
+	  if (st.quote_char == '\'')
+	    st.found_quote |= RL_QF_SINGLE_QUOTE;
+	  else if (st.quote_char == '"')
+	    st.found_quote |= RL_QF_DOUBLE_QUOTE;
+	  else
+	    st.found_quote |= RL_QF_OTHER_QUOTE;
+	}
+    }
+
+  *startp = st.quote_char ? st.quote_start : end;
+  *foundp = st.found_quote;
+  return (st.quote_char);
+}
+
 /* Find the bounds of the current word for completion purposes, and leave
    rl_point set to the end of the word.  This function skips quoted
    substrings (characters between matched pairs of characters in
@@ -1088,7 +1818,7 @@ char
 _rl_find_completion_word (fp, dp)
      int *fp, *dp;
 {
-  int scan, end, found_quote, delimiter, pass_next, isbrk;
+  int scan, end, found_quote, delimiter, isbrk;
   char quote_char, *brkchars;
 
   end = rl_point;
@@ -1101,56 +1831,14 @@ _rl_find_completion_word (fp, dp)
   if (brkchars == 0)
     brkchars = rl_completer_word_break_characters;
 
-  if (rl_completer_quote_characters)
-    {
-      /* We have a list of characters which can be used in pairs to
-	 quote substrings for the completer.  Try to find the start
-	 of an unclosed quoted substring. */
-      /* FOUND_QUOTE is set so we know what kind of quotes we found. */
-      for (scan = pass_next = 0; scan < end; scan = MB_NEXTCHAR (rl_line_buffer, scan, 1, MB_FIND_ANY))
-	{
-	  if (pass_next)
-	    {
-	      pass_next = 0;
-	      continue;
-	    }
-
-	  /* Shell-like semantics for single quotes -- don't allow backslash
-	     to quote anything in single quotes, especially not the closing
-	     quote.  If you don't like this, take out the check on the value
-	     of quote_char. */
-	  if (quote_char != '\'' && rl_line_buffer[scan] == '\\')
-	    {
-	      pass_next = 1;
-	      found_quote |= RL_QF_BACKSLASH;
-	      continue;
-	    }
+  set_char_class (CC_WORD_BREAK, brkchars);
 
-	  if (quote_char != '\0')
-	    {
-	      /* Ignore everything until the matching close quote char. */
-	      if (rl_line_buffer[scan] == quote_char)
-		{
-		  /* Found matching close.  Abandon this substring. */
-		  quote_char = '\0';
-		  rl_point = end;
-		}
-	    }
-	  else if (strchr (rl_completer_quote_characters, rl_line_buffer[scan]))
-	    {
-	      /* Found start of a quoted substring. */
-	      quote_char = rl_line_buffer[scan];
-	      rl_point = scan + 1;
-	      /* Shell-like quoting conventions. */
-	      if (quote_char == '\'')
-		found_quote |= RL_QF_SINGLE_QUOTE;
-	      else if (quote_char == '"')
-		found_quote |= RL_QF_DOUBLE_QUOTE;
-	      else
-		found_quote |= RL_QF_OTHER_QUOTE;      
-	    }
-	}
-    }
+  /* We have a list of characters which can be used in pairs to quote
+     substrings for the completer.  Try to find the start of an unclosed
+     quoted substring.  FOUND_QUOTE is set so we know what kind of quotes
+     we found. */
+  if (rl_completer_quote_characters)
+    quote_char = scan_for_unclosed_quote (end, &rl_point, &found_quote);
 
   if (rl_point == end && quote_char == '\0')
     {
@@ -1161,7 +1849,7 @@ _rl_find_completion_word (fp, dp)
 	{
 	  scan = rl_line_buffer[rl_point];
 
-	  if (strchr (brkchars, scan) == 0)
+	  if (CHAR_CLASS_P (scan, CC_WORD_BREAK) == 0)
 	    continue;
 
 	  /* Call the application-specific function to tell us whether
@@ -1189,9 +1877,9 @@ _rl_find_completion_word (fp, dp)
       if (rl_char_is_quoted_p)
 	isbrk = (found_quote == 0 ||
 		(*rl_char_is_quoted_p) (rl_line_buffer, rl_point) == 0) &&
-		strchr (brkchars, scan) != 0;
+		CHAR_CLASS_P (scan, CC_WORD_BREAK);
       else
-	isbrk = strchr (brkchars, scan) != 0;
+	isbrk = CHAR_CLASS_P (scan, CC_WORD_BREAK) != 0;
 
       if (isbrk)
 	{
@@ -1217,29 +1905,43 @@ _rl_find_completion_word (fp, dp)
   return (quote_char);
 }
 
+/* Generate the list of matches for TEXT, which is between START and END
+   in LINE, the contents of rl_line_buffer. */
 static char **
-gen_completion_matches (text, start, end, our_func, found_quote, quote_char)
+gen_completion_matches (text, start, end, our_func, found_quote, quote_char, line)
      char *text;
      int start, end;
      rl_compentry_func_t *our_func;
      int found_quote, quote_char;
+     const char *line;
 {
   char **matches;
+  int monotonic;
+
+  /* Generators are never run on two threads at once. */
+  COMPLETION_EXCLUSIVE ();
 
   rl_completion_found_quote = found_quote;
   rl_completion_quote_character = quote_char;
+  rl_completion_matches_omitted = 0;
+
+#if defined (MATCH_FILE_TYPES)
+  clear_match_file_types ();
+#endif
 
   /* If the user wants to TRY to complete, but then wants to give
      up and use the default completion function, they set the
      variable rl_attempted_completion_function. */
   if (rl_attempted_completion_function)
     {
+      completion_attempt_depth++;
       matches = (*rl_attempted_completion_function) (text, start, end);
-      if (RL_SIG_RECEIVED())
+      completion_attempt_depth--;
+      if (COMPLETION_INTERRUPTED ())
 	{
 	  _rl_free_match_list (matches);
 	  matches = 0;
-	  RL_CHECK_SIGNALS ();
+	  COMPLETION_CHECK_SIGNALS ();
 	}
 
       if (matches || rl_attempted_completion_over)
@@ -1251,18 +1953,219 @@ gen_completion_matches (text, start, end, our_func, found_quote, quote_char)
 
   /* XXX -- filename dequoting moved into rl_filename_completion_function */
 
+  /* Readline's own generators aren't monotonic, even if the application's
+     is: `dir/' matches the files in dir, not `dir' itself. */
+  monotonic = rl_completion_entry_monotonic &&
+	      our_func != rl_filename_completion_function &&
+	      our_func != rl_username_completion_function &&
+	      our_func != rl_indexed_path_completion_function;
+
+  if (monotonic && narrow_completion_matches (text, start, our_func, line, &matches))
+    return matches;
+
   /* rl_completion_matches will check for signals as well to avoid a long
-     delay while reading a directory. */
-  matches = rl_completion_matches (text, our_func);
-  if (RL_SIG_RECEIVED())
+     delay while reading a directory.  The matches don't go back to the
+     application, so they can come from an arena. */
+  matches = completion_matches (text, our_func, 1);
+  if (COMPLETION_INTERRUPTED ())
     {
       _rl_free_match_list (matches);
       matches = 0;
-      RL_CHECK_SIGNALS ();
+      COMPLETION_CHECK_SIGNALS ();
     }
+  if (monotonic)
+    save_completion_matches (matches, text, start, our_func, line);
   return matches;  
 }
 
+/* The matches a monotonic completion entry function returned the last
+   time it was called, and what it was called with, so we can narrow them
+   if the user types more characters in the same word. */
+static char **saved_matches = (char **)NULL;	/* without the LCD */
+static int saved_nmatches;
+static char *saved_text = (char *)NULL;
+static char *saved_context = (char *)NULL;	/* rl_line_buffer before TEXT */
+static rl_compentry_func_t *saved_func;
+static int saved_fold, saved_quote;
+
+/* What the entry function said about the saved matches.  Each completion
+   attempt resets these, so narrowing the list has to put them back. */
+static int saved_filename_desired, saved_quoting_desired;
+static int saved_suppress_append, saved_suppress_quote;
+static int saved_append_character, saved_mark_symlink_dirs;
+
+/* Return non-zero if the first LEN characters of S and TEXT are the same,
+   using the same case-sensitivity as the completion functions. */
+#define MATCH_PREFIX(s, text, len) \
+  ((_rl_completion_case_fold ? _rl_strnicmp ((s), (text), (len)) \
+			     : strncmp ((s), (text), (len))) == 0)
+
+/* Save MATCHES, the list FUNC generated for TEXT, which starts at START
+   in LINE.  Matches in an arena are kept by holding a reference to them,
+   so only matches from the application's generators are copied, and
+   those into a single arena of their own. */
+static void
+save_completion_matches (matches, text, start, func, line)
+     char **matches;
+     const char *text;
+     int start;
+     rl_compentry_func_t *func;
+     const char *line;
+{
+  register int i, n, len;
+  MATCH_ARENA *copies;
+
+  if (saved_matches)
+    _rl_free_match_list (saved_matches);
+  FREE (saved_text);
+  FREE (saved_context);
+  saved_matches = (char **)NULL;
+  saved_text = saved_context = (char *)NULL;
+
+  /* A single match has already been moved to matches[0]. */
+  for (n = 0; matches && matches[n + 1]; n++)
+    ;
+  if (matches && n == 0)
+    n = 1;
+  else if (matches)
+    matches++;
+
+  /* We can only narrow the list later if it has all the matches and they
+     all begin with TEXT. */
+  if (rl_completion_matches_omitted)
+    return;
+  len = strlen (text);
+  for (i = 0; i < n; i++)
+    if (MATCH_PREFIX (matches[i], text, len) == 0)
+      return;
+
+  saved_matches = (char **)xmalloc ((n + 1) * sizeof (char *));
+  copies = (MATCH_ARENA *)NULL;
+  for (i = 0; i < n; i++)
+    {
+      if (hold_match (matches[i]))
+	saved_matches[i] = matches[i];
+      else
+	{
+	  if (copies == 0)
+	    copies = new_match_arena ();
+	  len = strlen (matches[i]);
+	  saved_matches[i] = (char *)memcpy (arena_alloc (copies, len + 1), matches[i], len + 1);
+	}
+    }
+  end_match_arena (copies);
+  saved_matches[n] = (char *)NULL;
+  saved_nmatches = n;
+
+  saved_text = savestring (text);
+  saved_context = (char *)xmalloc (start + 1);
+  strncpy (saved_context, line, start);
+  saved_context[start] = '\0';
+  saved_func = func;
+  saved_fold = _rl_completion_case_fold;
+  saved_quote = rl_completion_quote_character;
+
+  saved_filename_desired = rl_filename_completion_desired;
+  saved_quoting_desired = rl_filename_quoting_desired;
+  saved_suppress_append = rl_completion_suppress_append;
+  saved_suppress_quote = rl_completion_suppress_quote;
+  saved_append_character = rl_completion_append_character;
+  saved_mark_symlink_dirs = rl_completion_mark_symlink_dirs;
+}
+
+/* If TEXT, starting at START in LINE, extends the text of the last saved
+   list of matches from FUNC in the same context, put the saved matches
+   that begin with TEXT into a new match list in *MATCHESP, restore what
+   FUNC said about them, and return 1.  The new list shares the saved
+   strings.  Otherwise return 0. */
+static int
+narrow_completion_matches (text, start, func, line, matchesp)
+     const char *text;
+     int start;
+     rl_compentry_func_t *func;
+     const char *line;
+     char ***matchesp;
+{
+  char **list;
+  int i, len, n;
+
+  if (saved_matches == 0 || func != saved_func ||
+      saved_fold != _rl_completion_case_fold ||
+      saved_quote != rl_completion_quote_character)
+    return 0;
+  if (strlen (saved_context) != start || strncmp (saved_context, line, start))
+    return 0;
+  if (STREQN (saved_text, text, strlen (saved_text)) == 0)
+    return 0;
+
+  len = strlen (text);
+  list = (char **)xmalloc ((saved_nmatches + 2) * sizeof (char *));
+  for (i = n = 0; i < saved_nmatches; i++)
+    if (MATCH_PREFIX (saved_matches[i], text, len))
+      {
+	hold_match (saved_matches[i]);
+	list[++n] = saved_matches[i];
+      }
+  list[n + 1] = (char *)NULL;
+
+  rl_filename_completion_desired = saved_filename_desired;
+  rl_filename_quoting_desired = saved_quoting_desired;
+  rl_completion_suppress_append = saved_suppress_append;
+  rl_completion_suppress_quote = saved_suppress_quote;
+  rl_completion_append_character = saved_append_character;
+  rl_completion_mark_symlink_dirs = saved_mark_symlink_dirs;
+
+  *matchesp = finish_match_list (list, n, text);
+  return 1;
+}
+
+/* Find the strings in the N-element array MATCHES that duplicate an
+   earlier string, free them, and replace them with DEAD.  This uses a
+   hash table, so it doesn't need the array to be sorted.  Returns the
+   number of unique strings. */
+static int
+mark_duplicate_matches (matches, n, dead)
+     char **matches;
+     int n;
+     char *dead;
+{
+  int *table;
+  unsigned int hash, mask;
+  register int i, slot, newlen;
+  register unsigned char *s;
+
+  for (mask = 1; mask < (unsigned int)n * 2; mask <<= 1)
+    ;
+  table = (int *)xmalloc (mask * sizeof (int));
+  memset (table, 0xff, mask * sizeof (int));	/* all slots -1 */
+  mask--;
+
+  for (i = newlen = 0; i < n; i++)
+    {
+      /* FNV-1a */
+      for (hash = 2166136261U, s = (unsigned char *)matches[i]; *s; s++)
+	hash = (hash ^ *s) * 16777619U;
+
+      for (slot = hash & mask; table[slot] >= 0; slot = (slot + 1) & mask)
+	if (STREQ (matches[table[slot]], matches[i]))
+	  break;
+
+      if (table[slot] >= 0)
+	{
+	  free_match (matches[i]);
+	  matches[i] = dead;
+	}
+      else
+	{
+	  table[slot] = i;
+	  newlen++;
+	}
+    }
+
+  xfree (table);
+  return newlen;
+}
+
 /* Filter out duplicates in MATCHES.  This frees up the strings in
    MATCHES. */
 static char **
@@ -1278,24 +2181,29 @@ remove_duplicate_matches (matches)
   for (i = 0; matches[i]; i++)
     ;
 
-  /* Sort the array without matches[0], since we need it to
-     stay in place no matter what. */
-  if (i && rl_sort_completion_matches)
-    qsort (matches+1, i-1, sizeof (char *), (QSFUNC *)_rl_qsort_string_compare);
-
   /* Remember the lowest common denominator for it may be unique. */
   lowest_common = savestring (matches[0]);
 
-  for (i = newlen = 0; matches[i + 1]; i++)
+  /* Sort the array without matches[0], since we need it to
+     stay in place no matter what.  Duplicates are then adjacent.  If
+     we're not sorting, find them with a hash table instead. */
+  if (i && rl_sort_completion_matches && _rl_completion_ranked == 0)
     {
-      if (strcmp (matches[i], matches[i + 1]) == 0)
+      _rl_sort_string_array (matches+1, i-1);
+
+      for (i = newlen = 0; matches[i + 1]; i++)
 	{
-	  xfree (matches[i]);
-	  matches[i] = (char *)&dead_slot;
+	  if (strcmp (matches[i], matches[i + 1]) == 0)
+	    {
+	      free_match (matches[i]);
+	      matches[i] = (char *)&dead_slot;
+	    }
+	  else
+	    newlen++;
 	}
-      else
-	newlen++;
     }
+  else
+    newlen = (i > 1) ? mark_duplicate_matches (matches + 1, i - 1, &dead_slot) : 0;
 
   /* We have marked all the dead slots with (char *)&dead_slot.
      Copy all the non-dead entries into a new array. */
@@ -1308,7 +2216,7 @@ remove_duplicate_matches (matches)
   temp_array[j] = (char *)NULL;
 
   if (matches[0] != (char *)&dead_slot)
-    xfree (matches[0]);
+    free_match (matches[0]);
 
   /* Place the lowest common denominator back in [0]. */
   temp_array[0] = lowest_common;
@@ -1318,103 +2226,154 @@ remove_duplicate_matches (matches)
      insert. */
   if (j == 2 && strcmp (temp_array[0], temp_array[1]) == 0)
     {
-      xfree (temp_array[1]);
+      free_match (temp_array[1]);
       temp_array[1] = (char *)NULL;
     }
   return (temp_array);
 }
 
-/* Find the common prefix of the list of matches, and put it into
-   matches[0]. */
+/* Return the length of the common prefix of S1 and S2, looking at no
+   more than the first LIMIT bytes, which must not be longer than S1.  If
+   FOLD is non-zero, compare bytes without regard to case.  Most matches
+   share the whole prefix found so far, which strncmp checks quickly. */
 static int
-compute_lcd_of_matches (match_list, matches, text)
-     char **match_list;
-     int matches;
-     const char *text;
+byte_prefix_length (s1, s2, limit, fold)
+     const char *s1, *s2;
+     int limit, fold;
 {
-  register int i, c1, c2, si;
-  int low;		/* Count of max-matched characters. */
-  int lx;
-  char *dtext;		/* dequoted TEXT, if needed */
-#if defined (HANDLE_MULTIBYTE)
-  int v;
-  size_t v1, v2;
-  mbstate_t ps1, ps2;
-  wchar_t wc1, wc2;
-#endif
+  register int i;
 
-  /* If only one match, just use that.  Otherwise, compare each
-     member of the list with the next, finding out where they
-     stop matching. */
-  if (matches == 1)
+  if (strncmp (s1, s2, limit) == 0)
+    return limit;
+
+  if (fold)
     {
-      match_list[0] = match_list[1];
-      match_list[1] = (char *)NULL;
-      return 1;
+      for (i = 0; i < limit && s1[i]; i++)
+	if (_rl_to_lower (s1[i]) != _rl_to_lower (s2[i]))
+	  break;
     }
-
-  for (i = 1, low = 100000; i < matches; i++)
+  else
     {
+      for (i = 0; i < limit && s1[i]; i++)
+	if (s1[i] != s2[i])
+	  break;
+    }
+  return i;
+}
+
 #if defined (HANDLE_MULTIBYTE)
-      if (MB_CUR_MAX > 1 && rl_byte_oriented == 0)
-	{
+/* Return the offset of the start of the character in S that contains the
+   byte at offset LIMIT, or LIMIT if a character starts there. */
+static int
+mb_char_boundary (s, limit)
+     const char *s;
+     int limit;
+{
+  mbstate_t ps;
+  size_t v;
+  register int i;
+
+  memset (&ps, 0, sizeof (mbstate_t));
+  for (i = 0; i < limit; i += v)
+    {
+      v = mbrlen (s + i, MB_CUR_MAX, &ps);
+      if (MB_INVALIDCH (v) || v == 0)
+	{
+	  memset (&ps, 0, sizeof (mbstate_t));
+	  v = 1;		/* treat as a single byte */
+	}
+      if (i + v > limit)
+	break;
+    }
+  return i;
+}
+
+/* Continue comparing S1 and S2 from SI, a character boundary, ignoring
+   the case of multibyte characters, and return the length of their
+   common prefix.  Don't look past LIMIT. */
+static int
+mb_fold_prefix_length (s1, s2, si, limit)
+     const char *s1, *s2;
+     int si, limit;
+{
+  mbstate_t ps1, ps2;
+  size_t v1, v2;
+  wchar_t wc1, wc2;
+
+  memset (&ps1, 0, sizeof (mbstate_t));
+  memset (&ps2, 0, sizeof (mbstate_t));
+  while (si < limit && s1[si] && s2[si])
+    {
+      v1 = mbrtowc (&wc1, s1 + si, MB_CUR_MAX, &ps1);
+      v2 = mbrtowc (&wc2, s2 + si, MB_CUR_MAX, &ps2);
+      if (MB_INVALIDCH (v1) || MB_INVALIDCH (v2))
+	{
+	  /* do byte comparison */
+	  if (_rl_to_lower (s1[si]) != _rl_to_lower (s2[si]))
+	    break;
 	  memset (&ps1, 0, sizeof (mbstate_t));
 	  memset (&ps2, 0, sizeof (mbstate_t));
+	  si++;
+	  continue;
 	}
-#endif
-      if (_rl_completion_case_fold)
-	{
-	  for (si = 0;
-	       (c1 = _rl_to_lower(match_list[i][si])) &&
-	       (c2 = _rl_to_lower(match_list[i + 1][si]));
-	       si++)
+      /* A common prefix has to be the same length in both strings. */
+      if (v1 != v2 || towlower (wc1) != towlower (wc2))
+	break;
+      si += (v1 > 1) ? v1 : 1;
+    }
+  return si;
+}
+#endif /* HANDLE_MULTIBYTE */
+
+/* Find the common prefix of the list of matches, and put it into
+   matches[0]. */
+static int
+compute_lcd_of_matches (match_list, matches, text)
+     char **match_list;
+     int matches;
+     const char *text;
+{
+  register int i, si;
+  int low;		/* Count of max-matched characters. */
+  int lx;
+  char *dtext;		/* dequoted TEXT, if needed */
 #if defined (HANDLE_MULTIBYTE)
-	    if (MB_CUR_MAX > 1 && rl_byte_oriented == 0)
-	      {
-		v1 = mbrtowc(&wc1, match_list[i]+si, strlen (match_list[i]+si), &ps1);
-		v2 = mbrtowc (&wc2, match_list[i+1]+si, strlen (match_list[i+1]+si), &ps2);
-		if (MB_INVALIDCH (v1) || MB_INVALIDCH (v2))
-		  {
-		    if (c1 != c2)	/* do byte comparison */
-		      break;
-		    continue;
-		  }
-		wc1 = towlower (wc1);
-		wc2 = towlower (wc2);
-		if (wc1 != wc2)
-		  break;
-		else if (v1 > 1)
-		  si += v1 - 1;
-	      }
-	    else
+  int mb;
 #endif
-	    if (c1 != c2)
-	      break;
-	}
-      else
-	{
-	  for (si = 0;
-	       (c1 = match_list[i][si]) &&
-	       (c2 = match_list[i + 1][si]);
-	       si++)
+
+  /* If only one match, just use that.  Otherwise, compare each
+     member of the list with the first, finding out where they
+     stop matching.  Each comparison only needs to look as far as the
+     common prefix found so far. */
+  if (matches == 1)
+    {
+      match_list[0] = match_list[1];
+      match_list[1] = (char *)NULL;
+      return 1;
+    }
+
 #if defined (HANDLE_MULTIBYTE)
-	    if (MB_CUR_MAX > 1 && rl_byte_oriented == 0)
-	      {
-		mbstate_t ps_back;
-		ps_back = ps1;
-		if (!_rl_compare_chars (match_list[i], si, &ps1, match_list[i+1], si, &ps2))
-		  break;
-		else if ((v = _rl_get_char_len (&match_list[i][si], &ps_back)) > 1)
-		  si += v - 1;
-	      }
-	    else
+  mb = MB_CUR_MAX > 1 && rl_byte_oriented == 0;
 #endif
-	    if (c1 != c2)
-	      break;
+  low = strlen (match_list[1]);
+  for (i = 2; i <= matches && low > 0; i++)
+    {
+      si = byte_prefix_length (match_list[1], match_list[i], low, _rl_completion_case_fold);
+      if (si == low)
+	continue;
+#if defined (HANDLE_MULTIBYTE)
+      /* The matching bytes may end partway through a character.  Back up
+	 to the start of that character, then, if we're ignoring case,
+	 compare characters from there, since characters that differ only
+	 in case need not have any bytes in common. */
+      if (mb)
+	{
+	  si = mb_char_boundary (match_list[1], si);
+	  if (_rl_completion_case_fold)
+	    si = mb_fold_prefix_length (match_list[1], match_list[i], si, low);
 	}
-
-      if (low > si)
-	low = si;
+#endif
+      low = si;
     }
 
   /* If there were multiple matches, but none matched up to even the
@@ -1456,7 +2415,7 @@ compute_lcd_of_matches (match_list, matches, text)
 	    }
 
 	  /* sort the list to get consistent answers. */
-	  qsort (match_list+1, matches, sizeof(char *), (QSFUNC *)_rl_qsort_string_compare);
+	  _rl_sort_string_array (match_list+1, matches);
 
 	  si = strlen (text);
 	  lx = (si <= low) ? si : low;	/* check shorter of text and matches */
@@ -1516,6 +2475,8 @@ postprocess_matches (matchesp, matching_filenames)
     {
       for (nmatch = 1; matches[nmatch]; nmatch++)
 	;
+      /* The application's function frees the matches it removes. */
+      unpool_match_list (matches);
       (void)(*rl_ignore_some_completions_function) (matches);
       if (matches == 0 || matches[0] == 0)
 	{
@@ -1558,6 +2519,87 @@ complete_get_screenwidth ()
   return _rl_screenwidth;
 }
 
+/* Write N spaces to pad a column of the list of matches. */
+static void
+pad_column (n)
+     int n;
+{
+  static const char spaces[] = "                                ";
+  int k;
+
+  for ( ; n > 0; n -= k)
+    {
+      k = (n < (int)sizeof (spaces) - 1) ? n : (int)sizeof (spaces) - 1;
+      fwrite (spaces, 1, k, rl_outstream);
+    }
+}
+
+/* Find the part of each of the LEN matches in MATCHES we display and how
+   wide it is, so we only have to do that once per match.  The returned
+   array is indexed like MATCHES.  If MAXP is non-null, set it to the
+   width of the widest one. */
+static MATCH_DISPLAY *
+match_display_info (matches, len, maxp)
+     char **matches;
+     int len, *maxp;
+{
+  MATCH_DISPLAY *info;
+  int i, max;
+
+  info = (MATCH_DISPLAY *)xmalloc ((len + 1) * sizeof (MATCH_DISPLAY));
+  for (max = 0, i = 1; i <= len; i++)
+    {
+      info[i].match = matches[i];
+      info[i].print = printable_part (matches[i]);
+      info[i].width = fnwidth (info[i].print);
+      info[i].special = fnspecial (info[i].print);
+      if (info[i].width > max)
+	max = info[i].width;
+    }
+  if (maxp)
+    *maxp = max;
+  return info;
+}
+
+/* Order display entries by the address of their match. */
+static int
+match_display_compare (a, b)
+     const void *a, *b;
+{
+  const char *ma, *mb;
+
+  ma = ((const MATCH_DISPLAY *)a)->match;
+  mb = ((const MATCH_DISPLAY *)b)->match;
+  return ((ma > mb) - (ma < mb));
+}
+
+/* Sort the LEN matches in MATCHES and put INFO, which match_display_info
+   made for them, in the same order.  We sort the strings as everywhere
+   else, then find each one's entry by its address, which is cheaper than
+   working out every match's width again. */
+static void
+sort_match_display (matches, info, len)
+     char **matches;
+     MATCH_DISPLAY *info;
+     int len;
+{
+  MATCH_DISPLAY *byaddr, key, *e;
+  register int i;
+
+  _rl_sort_string_array (matches + 1, len);
+
+  byaddr = (MATCH_DISPLAY *)xmalloc (len * sizeof (MATCH_DISPLAY));
+  memcpy (byaddr, info + 1, len * sizeof (MATCH_DISPLAY));
+  qsort (byaddr, len, sizeof (MATCH_DISPLAY), (QSFUNC *)match_display_compare);
+  for (i = 1; i <= len; i++)
+    {
+      key.match = matches[i];
+      e = (MATCH_DISPLAY *)bsearch (&key, byaddr, len, sizeof (MATCH_DISPLAY), (QSFUNC *)match_display_compare);
+      info[i] = *e;
+    }
+  xfree (byaddr);
+}
+
 /* A convenience function for displaying a list of strings in
    columnar format on readline's output stream.  MATCHES is the list
    of strings, in argv format, LEN is the number of strings in MATCHES,
@@ -1567,10 +2609,31 @@ rl_display_match_list (matches, len, max)
      char **matches;
      int len, max;
 {
-  int count, limit, printed_len, lines, cols;
-  int i, j, k, l, common_length, sind;
+  MATCH_DISPLAY *info;
+
+  /* Sort the items if they are not already sorted. */
+  if (rl_ignore_completion_duplicates == 0 && rl_sort_completion_matches && _rl_completion_ranked == 0)
+    _rl_sort_string_array (matches + 1, len);
+
+  info = match_display_info (matches, len, (int *)NULL);
+  display_match_list_internal (matches, info, len, max);
+  xfree (info);
+}
+
+/* Work out how to lay out a list of MATCHES, the widest of which is *MAXP
+   characters wide.  Set *MAXP to the width of a column and *SINDP to the
+   length in bytes of the prefix common to all the matches that
+   print_filename shows specially, and return the number of columns. */
+static int
+match_list_layout (matches, maxp, sindp)
+     char **matches;
+     int *maxp, *sindp;
+{
+  int limit, cols, max, common_length, sind;
   char *temp, *t;
 
+  max = *maxp;
+
   /* Find the length of the prefix common to all items: length as displayed
      characters (common_length) and as a byte index into the matches (sind) */
   common_length = sind = 0;
@@ -1617,6 +2680,25 @@ rl_display_match_list (matches, len, max)
   if (limit == 0)
     limit = 1;
 
+  *maxp = max;
+  *sindp = sind;
+  return (limit);
+}
+
+/* Display the LEN matches in MATCHES, which are sorted if they need to
+   be, in columns MAX characters wide.  INFO says what to print for each
+   one and how wide it is. */
+static void
+display_match_list_internal (matches, info, len, max)
+     char **matches;
+     MATCH_DISPLAY *info;
+     int len, max;
+{
+  int count, limit, printed_len, lines;
+  int i, j, l, sind;
+
+  limit = match_list_layout (matches, &max, &sind);
+
   /* How many iterations of the printing loop? */
   count = (len + (limit - 1)) / limit;
 
@@ -1624,10 +2706,6 @@ rl_display_match_list (matches, len, max)
      just do the inner printing loop.
 	   0 < len <= limit  implies  count = 1. */
 
-  /* Sort the items if they are not already sorted. */
-  if (rl_ignore_completion_duplicates == 0 && rl_sort_completion_matches)
-    qsort (matches + 1, len, sizeof (char *), (QSFUNC *)_rl_qsort_string_compare);
-
   rl_crlf ();
 
   lines = 0;
@@ -1642,17 +2720,11 @@ rl_display_match_list (matches, len, max)
 		break;
 	      else
 		{
-		  temp = printable_part (matches[l]);
-		  printed_len = print_filename (temp, matches[l], sind);
+		  printed_len = print_filename (info[l].print, matches[l], sind,
+						info[l].special ? -1 : info[l].width);
 
 		  if (j + 1 < limit)
-		    {
-		      if (max <= printed_len)
-			putc (' ', rl_outstream);
-		      else
-			for (k = 0; k < max - printed_len; k++)
-			  putc (' ', rl_outstream);
-		    }
+		    pad_column ((max <= printed_len) ? 1 : max - printed_len);
 		}
 	      l += count;
 	    }
@@ -1677,8 +2749,8 @@ rl_display_match_list (matches, len, max)
       /* Print the sorted items, across alphabetically, like ls -x. */
       for (i = 1; matches[i]; i++)
 	{
-	  temp = printable_part (matches[i]);
-	  printed_len = print_filename (temp, matches[i], sind);
+	  printed_len = print_filename (info[i].print, matches[i], sind,
+					info[i].special ? -1 : info[i].width);
 	  /* Have we reached the end of this line? */
 #if defined (SIGWINCH)
 	  if (RL_SIG_RECEIVED () && RL_SIGWINCH_RECEIVED() == 0)
@@ -1699,17 +2771,315 @@ rl_display_match_list (matches, len, max)
 			return;
 		    }
 		}
-	      else if (max <= printed_len)
-		putc (' ', rl_outstream);
 	      else
-		for (k = 0; k < max - printed_len; k++)
-		  putc (' ', rl_outstream);
+		pad_column ((max <= printed_len) ? 1 : max - printed_len);
 	    }
 	}
       rl_crlf ();
     }
 }
 
+/* The keys of the matches being sorted for a scrolling list. */
+static char **pager_sort_keys;
+
+static int
+pager_key_compare (a, b)
+     const void *a, *b;
+{
+  char *s1, *s2;
+
+  s1 = pager_sort_keys[*(const int *)a];
+  s2 = pager_sort_keys[*(const int *)b];
+  return (_rl_completion_case_fold ? _rl_stricmp (s1, s2) : strcmp (s1, s2));
+}
+
+/* Add C to the characters narrowing the scrolling list P.  The matches
+   whose keys begin with the new filter are a contiguous part of the
+   range that matched the old one, so we find them by binary search.
+   Return 0, leaving P unchanged, if no match begins with the new filter. */
+static int
+pager_narrow (p, c)
+     MATCH_PAGER *p;
+     int c;
+{
+  int lo, hi, mid, first, n, r;
+
+  if (p->flen + 2 >= p->fsize)
+    {
+      p->fsize *= 2;
+      p->filter = (char *)xrealloc (p->filter, p->fsize);
+      p->first = (int *)xrealloc (p->first, p->fsize * sizeof (int));
+      p->last = (int *)xrealloc (p->last, p->fsize * sizeof (int));
+    }
+  p->filter[p->flen] = c;
+  n = p->flen + 1;
+
+#define PAGER_KEYCMP(i) \
+  (_rl_completion_case_fold ? _rl_strnicmp (p->keys[p->order[i]], p->filter, n) \
+			    : strncmp (p->keys[p->order[i]], p->filter, n))
+
+  /* First match that doesn't sort before the filter. */
+  lo = p->first[p->flen];
+  hi = p->last[p->flen];
+  while (lo < hi)
+    {
+      mid = lo + (hi - lo) / 2;
+      if (PAGER_KEYCMP (mid) < 0)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+  first = lo;
+
+  /* First match after that which sorts after the filter. */
+  hi = p->last[p->flen];
+  while (lo < hi)
+    {
+      mid = lo + (hi - lo) / 2;
+      r = PAGER_KEYCMP (mid);
+      if (r <= 0)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+#undef PAGER_KEYCMP
+
+  if (first == lo)
+    return 0;
+
+  p->flen = n;
+  p->first[n] = first;
+  p->last[n] = lo;
+  p->filter[n] = '\0';
+  return 1;
+}
+
+/* Show the window of the scrolling list P beginning at row P->top.  Only
+   the matches in that window are printed.  If REDRAW is non-zero, the
+   window has already been shown and the cursor is on the status line
+   below it, so go back up and overwrite it. */
+static void
+pager_draw (p, redraw)
+     MATCH_PAGER *p;
+     int redraw;
+{
+  int n, rows, r, c, i, l, printed_len;
+
+  n = p->last[p->flen] - p->first[p->flen];
+  rows = (n + p->cols - 1) / p->cols;
+  if (p->top > rows - p->height)
+    p->top = rows - p->height;
+  if (p->top < 0)
+    p->top = 0;
+
+  if (redraw)
+    {
+      putc ('\r', rl_outstream);
+      for (r = 0; r < p->height; r++)
+	tputs (_rl_term_up, 1, _rl_output_character_function);
+    }
+
+  for (r = p->top; r < p->top + p->height; r++)
+    {
+      for (c = 0; r < rows && c < p->cols; c++)
+	{
+	  i = _rl_print_completions_horizontally ? r * p->cols + c : r + c * rows;
+	  if (i >= n)
+	    break;
+	  l = p->order[p->first[p->flen] + i];
+	  printed_len = print_filename (p->info[l].print, p->matches[l], p->sind,
+					p->info[l].special ? -1 : p->info[l].width);
+	  if (c + 1 < p->cols)
+	    pad_column ((p->max <= printed_len) ? 1 : p->max - printed_len);
+	}
+      _rl_clear_to_eol (0);
+      rl_crlf ();
+    }
+
+  fprintf (rl_outstream, "--More--(%d-%d/%d)", rows ? p->top + 1 : 0,
+	   (p->top + p->height < rows) ? p->top + p->height : rows, rows);
+  if (p->flen)
+    fprintf (rl_outstream, " %s", p->filter);
+  _rl_clear_to_eol (0);
+  fflush (rl_outstream);
+}
+
+/* Read a key for the scrolling list of matches, translating the keys that
+   move through it into PAGER_* commands.  Other keys are returned as
+   they are. */
+static int
+pager_read_key ()
+{
+  int c;
+
+  RL_SETSTATE(RL_STATE_MOREINPUT);
+  c = rl_read_key ();
+  if (c == ESC)
+    {
+      /* A lone ESC quits; otherwise look for the arrow and paging keys
+	 most terminals send, and the emacs-mode meta keys. */
+      if (_rl_input_queued ((_rl_keyseq_timeout > 0) ? _rl_keyseq_timeout*1000 : 0) == 0)
+	c = PAGER_QUIT;
+      else
+	{
+	  c = rl_read_key ();
+	  if (c == '[' || c == 'O')
+	    {
+	      switch (c = rl_read_key ())
+		{
+		case 'A': c = PAGER_LINE_UP; break;
+		case 'B': c = PAGER_LINE_DOWN; break;
+		case 'H': c = PAGER_TOP; break;
+		case 'F': c = PAGER_BOTTOM; break;
+		case '5':
+		case '6':
+		  c = (c == '5') ? PAGER_PAGE_UP : PAGER_PAGE_DOWN;
+		  if (rl_read_key () != '~')
+		    c = PAGER_NONE;
+		  break;
+		default: c = PAGER_NONE; break;
+		}
+	    }
+	  else if (c == 'v')
+	    c = PAGER_PAGE_UP;
+	  else if (c == '<')
+	    c = PAGER_TOP;
+	  else if (c == '>')
+	    c = PAGER_BOTTOM;
+	  else
+	    c = PAGER_NONE;
+	}
+    }
+  else if (c == CTRL ('P'))
+    c = PAGER_LINE_UP;
+  else if (c == CTRL ('N'))
+    c = PAGER_LINE_DOWN;
+  else if (c == CTRL ('V') || c == TAB)
+    c = PAGER_PAGE_DOWN;
+  else if (c == ABORT_CHAR || c == NEWLINE || c == RETURN || c < 0)
+    c = PAGER_QUIT;
+  RL_UNSETSTATE(RL_STATE_MOREINPUT);
+
+  return c;
+}
+
+/* Show the LEN matches in MATCHES, the widest of which is MAX characters
+   wide, as a list the user can scroll through a screenful at a time and
+   narrow by typing the characters that follow the prefix the matches
+   have in common.  The cost of each key is proportional to the size of
+   the screen, not the number of matches.  Return 0 without doing
+   anything if the list fits on the screen or the terminal can't move
+   the cursor up and clear lines. */
+static int
+scroll_match_list (matches, info, len, max)
+     char **matches;
+     MATCH_DISPLAY *info;
+     int len, max;
+{
+  MATCH_PAGER p;
+  int i, c, skip;
+  char *t;
+
+#if defined (READLINE_CALLBACKS)
+  /* Like the pager, this reads keys itself. */
+  if (RL_ISSTATE (RL_STATE_CALLBACK))
+    return 0;
+#endif
+  if (_rl_term_up == 0 || *_rl_term_up == 0 || _rl_term_clreol == 0)
+    return 0;
+
+  p.height = _rl_screenheight - 2;
+  p.max = max;
+  p.cols = match_list_layout (matches, &p.max, &p.sind);
+  if (p.height < 1 || (len + p.cols - 1) / p.cols <= p.height)
+    return 0;
+
+  p.matches = matches;
+  p.info = info;
+
+  /* All the matches begin with the common prefix in matches[0], so the
+     user narrows the list by typing what follows it. */
+  skip = strlen (printable_part (matches[0]));
+  p.keys = (char **)xmalloc ((len + 1) * sizeof (char *));
+  p.order = (int *)xmalloc (len * sizeof (int));
+  for (i = 1; i <= len; i++)
+    {
+      for (t = info[i].print; *t && t - info[i].print < skip; t++)
+	;
+      p.keys[i] = t;
+      p.order[i - 1] = i;
+    }
+  pager_sort_keys = p.keys;
+  qsort (p.order, len, sizeof (int), pager_key_compare);
+
+  p.fsize = 16;
+  p.filter = (char *)xmalloc (p.fsize);
+  p.first = (int *)xmalloc (p.fsize * sizeof (int));
+  p.last = (int *)xmalloc (p.fsize * sizeof (int));
+  p.flen = 0;
+  p.filter[0] = '\0';
+  p.first[0] = 0;
+  p.last[0] = len;
+  p.top = 0;
+
+  rl_crlf ();
+  pager_draw (&p, 0);
+
+  while ((c = pager_read_key ()) != PAGER_QUIT)
+    {
+      switch (c)
+	{
+	case PAGER_LINE_UP:
+	  p.top--;
+	  break;
+	case PAGER_LINE_DOWN:
+	  p.top++;
+	  break;
+	case PAGER_PAGE_UP:
+	  p.top -= p.height;
+	  break;
+	case PAGER_PAGE_DOWN:
+	  p.top += p.height;
+	  break;
+	case PAGER_TOP:
+	  p.top = 0;
+	  break;
+	case PAGER_BOTTOM:
+	  p.top = len;		/* pager_draw clamps it */
+	  break;
+	case RUBOUT:
+	case CTRL ('H'):
+	  if (p.flen == 0)
+	    {
+	      rl_ding ();
+	      continue;
+	    }
+	  p.filter[--p.flen] = '\0';
+	  p.top = 0;
+	  break;
+	default:
+	  if (c >= PAGER_NONE || CTRL_CHAR (c) || pager_narrow (&p, c) == 0)
+	    {
+	      rl_ding ();
+	      continue;
+	    }
+	  p.top = 0;
+	  break;
+	}
+      pager_draw (&p, 1);
+    }
+
+  /* Leave the last screenful of matches showing, like the pager. */
+  _rl_erase_entire_line ();
+
+  xfree (p.keys);
+  xfree (p.order);
+  xfree (p.filter);
+  xfree (p.first);
+  xfree (p.last);
+  return 1;
+}
+
 /* Display MATCHES, a list of matching filenames in argv format.  This
    handles the simple case -- a single match -- first.  If there is more
    than one match, we compute the number of strings in the list and the
@@ -1727,6 +3097,7 @@ display_matches (matches)
 {
   int len, max, i;
   char *temp;
+  MATCH_DISPLAY *info;
 
   /* Move to the last visible line of a possibly-multiple-line command. */
   _rl_move_vert (_rl_vis_botlin);
@@ -1736,7 +3107,7 @@ display_matches (matches)
     {
       temp = printable_part (matches[0]);
       rl_crlf ();
-      print_filename (temp, matches[0], 0);
+      print_filename (temp, matches[0], 0, -1);
       rl_crlf ();
 
       rl_forced_update_display ();
@@ -1746,34 +3117,34 @@ display_matches (matches)
     }
 
   /* There is more than one answer.  Find out how many there are,
-     and find the maximum printed length of a single entry. */
-  for (max = 0, i = 1; matches[i]; i++)
-    {
-      temp = printable_part (matches[i]);
-      len = fnwidth (temp);
-
-      if (len > max)
-	max = len;
-    }
-
+     and find the maximum printed length of a single entry.  Remember
+     what we print for each one and how wide it is so the listing
+     doesn't have to compute them again. */
+  for (i = 1; matches[i]; i++)
+    ;
   len = i - 1;
+  info = match_display_info (matches, len, &max);
 
-  /* If the caller has defined a display hook, then call that now. */
+  /* If the caller has defined a display hook, then call that now.  It
+     says how many matches were left out itself, if it wants to, from
+     rl_completion_matches_omitted. */
   if (rl_completion_display_matches_hook)
     {
+      xfree (info);
       (*rl_completion_display_matches_hook) (matches, len, max);
       return;
     }
 	
   /* If there are many items, then ask the user if she really wants to
      see them all. */
-  if (rl_completion_query_items > 0 && len >= rl_completion_query_items)
+  if (rl_completion_query_items > 0 && len + rl_completion_matches_omitted >= rl_completion_query_items)
     {
       rl_crlf ();
-      fprintf (rl_outstream, "Display all %d possibilities? (y or n)", len);
+      fprintf (rl_outstream, "Display all %d possibilities? (y or n)", len + rl_completion_matches_omitted);
       fflush (rl_outstream);
       if ((completion_y_or_n = get_y_or_n (0)) == 0)
 	{
+	  xfree (info);
 	  rl_crlf ();
 
 	  rl_forced_update_display ();
@@ -1783,7 +3154,19 @@ display_matches (matches)
 	}
     }
 
-  rl_display_match_list (matches, len, max);
+  /* Sort the items if they are not already sorted, taking the widths we
+     already found along with them. */
+  if (rl_ignore_completion_duplicates == 0 && rl_sort_completion_matches && _rl_completion_ranked == 0)
+    sort_match_display (matches, info, len);
+
+  if (_rl_scroll_completions == 0 || scroll_match_list (matches, info, len, max) == 0)
+    display_match_list_internal (matches, info, len, max);
+  xfree (info);
+  if (rl_completion_matches_omitted)
+    {
+      fprintf (rl_outstream, "(%d more not shown)", rl_completion_matches_omitted);
+      rl_crlf ();
+    }
 
   rl_forced_update_display ();
   rl_display_fixed = 1;
@@ -1795,7 +3178,6 @@ make_quoted_replacement (match, mtype, qc)
      int mtype;
      char *qc;	/* Pointer to quoting character, if any */
 {
-  int should_quote, do_replace;
   char *replacement;
 
   /* If we are doing completion on quoted substrings, and any matches
@@ -1808,30 +3190,75 @@ make_quoted_replacement (match, mtype, qc)
      matches don't require a quoted substring. */
   replacement = match;
 
-  should_quote = match && rl_completer_quote_characters &&
-			rl_filename_completion_desired &&
-			rl_filename_quoting_desired;
+  /* If there is a single match, see if we need to quote it.  This also
+     checks whether the common prefix of several matches needs to be
+     quoted.  Quote the replacement, since we found an embedded word
+     break character in a potential match. */
+  if (mtype != NO_MATCH && rl_filename_quoting_function &&
+	quoting_needed (match, qc, (int *)NULL))
+    replacement = (*rl_filename_quoting_function) (match, mtype, qc);
+  return (replacement);
+}
 
-  if (should_quote)
-    should_quote = should_quote && (!qc || !*qc ||
-		     (rl_completer_quote_characters && strchr (rl_completer_quote_characters, *qc)));
+/* Return the text insert-completions puts in place of the word being
+   completed: each of MATCHES quoted as make_quoted_replacement would
+   quote it, followed by a space.  One pass makes the quoting decisions
+   and sizes the result, and a second copies the matches into a single
+   allocation.  Matches that our own rl_quote_filename would quote are
+   quoted while they are copied, so they aren't allocated at all. */
+static char *
+quote_match_list (matches, qc)
+     char **matches;
+     char *qc;
+{
+  char **quoted, *result, *r;
+  int i, n, total, *lens;
+  char *prefix;
 
-  if (should_quote)
+  for (n = 0; matches[n]; n++)
+    ;
+  /* The quoted strings, their lengths, and the quote character to put in
+     front of each, all in one block. */
+  quoted = (char **)xmalloc (n * (sizeof (char *) + sizeof (int) + 1) + 1);
+  lens = (int *)(quoted + n);
+  prefix = (char *)(lens + n);
+
+  for (i = total = 0; i < n; i++)
     {
-      /* If there is a single match, see if we need to quote it.
-         This also checks whether the common prefix of several
-	 matches needs to be quoted. */
-      should_quote = rl_filename_quote_characters
-			? (_rl_strpbrk (match, rl_filename_quote_characters) != 0)
-			: 0;
+      quoted[i] = matches[i];
+      prefix[i] = '\0';
+      if (quoting_needed (matches[i], qc, &lens[i]) && rl_filename_quoting_function)
+	{
+	  if (rl_filename_quoting_function == rl_quote_filename)
+	    {
+	      prefix[i] = *rl_completer_quote_characters;
+	      if (qc)
+		*qc = prefix[i];
+	    }
+	  else
+	    {
+	      quoted[i] = (*rl_filename_quoting_function) (matches[i], SINGLE_MATCH, qc);
+	      lens[i] = strlen (quoted[i]);
+	    }
+	}
+      total += (prefix[i] != '\0') + lens[i] + 1;
+    }
 
-      do_replace = should_quote ? mtype : NO_MATCH;
-      /* Quote the replacement, since we found an embedded
-	 word break character in a potential match. */
-      if (do_replace != NO_MATCH && rl_filename_quoting_function)
-	replacement = (*rl_filename_quoting_function) (match, do_replace, qc);
+  result = r = (char *)xmalloc (total + 1);
+  for (i = 0; i < n; i++)
+    {
+      if (prefix[i])
+	*r++ = prefix[i];
+      memcpy (r, quoted[i], lens[i]);
+      r += lens[i];
+      *r++ = ' ';
+      if (quoted[i] != matches[i])
+	xfree (quoted[i]);
     }
-  return (replacement);
+  *r = '\0';
+
+  xfree (quoted);
+  return (result);
 }
 
 static void
@@ -1840,9 +3267,8 @@ insert_match (match, start, mtype, qc)
      int start, mtype;
      char *qc;
 {
-  char *replacement, *r;
-  char oqc;
-  int end, rlen;
+  char *replacement;
+  int oqc;
 
   oqc = qc ? *qc : '\0';
   replacement = make_quoted_replacement (match, mtype, qc);
@@ -1850,58 +3276,137 @@ insert_match (match, start, mtype, qc)
   /* Now insert the match. */
   if (replacement)
     {
-      rlen = strlen (replacement);
-      /* Don't double an opening quote character. */
-      if (qc && *qc && start && rl_line_buffer[start - 1] == *qc &&
-	    replacement[0] == *qc)
-	start--;
-      /* If make_quoted_replacement changed the quoting character, remove
-	 the opening quote and insert the (fully-quoted) replacement. */
-      else if (qc && (*qc != oqc) && start && rl_line_buffer[start - 1] == oqc &&
-	    replacement[0] != oqc)
-	start--;
-      end = rl_point - 1;
-      /* Don't double a closing quote character */
-      if (qc && *qc && end && rl_line_buffer[rl_point] == *qc && replacement[rlen - 1] == *qc)
-        end++;
-      if (_rl_skip_completed_text)
-	{
-	  r = replacement;
-	  while (start < rl_end && *r && rl_line_buffer[start] == *r)
-	    {
-	      start++;
-	      r++;
-	    }
-	  if (start <= end || *r)
-	    _rl_replace_text (r, start, end);
-	  rl_point = start + strlen (r);
-	}
-      else
-	_rl_replace_text (replacement, start, end);
+      insert_replacement (replacement, start, oqc, qc);
       if (replacement != match)
         xfree (replacement);
     }
 }
 
+/* Replace the text from START to point with REPLACEMENT, a match quoted
+   by make_quoted_replacement, which changed the quoting character from
+   OQC to *QC. */
+static void
+insert_replacement (replacement, start, oqc, qc)
+     char *replacement;
+     int start, oqc;
+     char *qc;
+{
+  char *r;
+  int end, rlen;
+
+  rlen = strlen (replacement);
+  /* Don't double an opening quote character. */
+  if (qc && *qc && start && rl_line_buffer[start - 1] == *qc &&
+	replacement[0] == *qc)
+    start--;
+  /* If make_quoted_replacement changed the quoting character, remove
+     the opening quote and insert the (fully-quoted) replacement. */
+  else if (qc && (*qc != oqc) && start && rl_line_buffer[start - 1] == oqc &&
+	replacement[0] != oqc)
+    start--;
+  end = rl_point - 1;
+  /* Don't double a closing quote character */
+  if (qc && *qc && end && rl_line_buffer[rl_point] == *qc && replacement[rlen - 1] == *qc)
+    end++;
+  if (_rl_skip_completed_text)
+    {
+      r = replacement;
+      while (start < rl_end && *r && rl_line_buffer[start] == *r)
+	{
+	  start++;
+	  r++;
+	}
+      if (start <= end || *r)
+	_rl_replace_text (r, start, end);
+      rl_point = start + strlen (r);
+    }
+  else
+    _rl_replace_text (replacement, start, end);
+}
+
+/* What append_to_match adds after a match, as found by match_append_type. */
+#define APPEND_DIRECTORY	1	/* a slash, if directories are marked */
+#define APPEND_NOTHING		2	/* nothing; a symlink to a directory */
+#define APPEND_SEPARATOR	3	/* closing quote and separator character */
+
+/* Decide what append_to_match should add after TEXT, the just-inserted
+   match.  If we're completing filenames, this finds out whether TEXT
+   is a directory.  If NONTRIVIAL_MATCH is set, we test for a symlink (if
+   the OS has them) and don't add a suffix for a symlink to a directory.
+   A nontrivial match is one that actually adds to the word being
+   completed.  The variable rl_completion_mark_symlink_dirs controls
+   this behavior (it's initially set to the what the user has chosen,
+   indicated by the value of _rl_complete_mark_symlink_dirs, but may be
+   modified by an application's completion function). */
+static int
+match_append_type (text, nontrivial_match)
+     char *text;
+     int nontrivial_match;
+{
+  char *filename, *fn;
+  int s, nofollow, type;
+  struct stat finfo;
+  mode_t ftype;
+
+  if (rl_filename_completion_desired == 0)
+    return APPEND_SEPARATOR;
+
+  filename = tilde_expand (text);
+  if (rl_filename_stat_hook)
+    {
+      fn = savestring (filename);
+      (*rl_filename_stat_hook) (&fn);
+      xfree (filename);
+      filename = fn;
+    }
+  /* Use the file type the filename completion function found, unless
+     we need to know what a symbolic link points to. */
+  nofollow = nontrivial_match && rl_completion_mark_symlink_dirs == 0;
+  ftype = match_file_type (text);
+  if (ftype && (nofollow || FTYPE_UNRESOLVED (ftype) == 0))
+    {
+      finfo.st_mode = ftype;
+      s = 0;
+    }
+  else
+    s = nofollow ? LSTAT (filename, &finfo) : stat (filename, &finfo);
+  if (s == 0 && S_ISDIR (finfo.st_mode))
+    type = APPEND_DIRECTORY;
+#ifdef S_ISLNK
+  /* Don't add anything if the filename is a symlink and resolves to a
+     directory. */
+  else if (s == 0 && S_ISLNK (finfo.st_mode) && path_isdir (filename))
+    type = APPEND_NOTHING;
+#endif
+  else
+    type = APPEND_SEPARATOR;
+  xfree (filename);
+
+  return type;
+}
+
 /* Append any necessary closing quote and a separator character to the
    just-inserted match.  If the user has specified that directories
    should be marked by a trailing `/', append one of those instead.  The
    default trailing character is a space.  Returns the number of characters
-   appended.  If NONTRIVIAL_MATCH is set, we test for a symlink (if the OS
-   has them) and don't add a suffix for a symlink to a directory.  A
-   nontrivial match is one that actually adds to the word being completed.
-   The variable rl_completion_mark_symlink_dirs controls this behavior
-   (it's initially set to the what the user has chosen, indicated by the
-   value of _rl_complete_mark_symlink_dirs, but may be modified by an
-   application's completion function). */
+   appended.  NONTRIVIAL_MATCH is as for match_append_type. */
 static int
 append_to_match (text, delimiter, quote_char, nontrivial_match)
      char *text;
      int delimiter, quote_char, nontrivial_match;
 {
-  char temp_string[4], *filename, *fn;
-  int temp_string_index, s;
-  struct stat finfo;
+  return (append_type_to_match (match_append_type (text, nontrivial_match),
+				delimiter, quote_char));
+}
+
+/* Do the work of append_to_match once match_append_type has said what
+   kind of thing TYPE to append. */
+static int
+append_type_to_match (type, delimiter, quote_char)
+     int type, delimiter, quote_char;
+{
+  char temp_string[4];
+  int temp_string_index;
 
   temp_string_index = 0;
   if (quote_char && rl_point && rl_completion_suppress_quote == 0 &&
@@ -1915,46 +3420,20 @@ append_to_match (text, delimiter, quote_char, nontrivial_match)
 
   temp_string[temp_string_index++] = '\0';
 
-  if (rl_filename_completion_desired)
+  if (type == APPEND_DIRECTORY)
     {
-      filename = tilde_expand (text);
-      if (rl_filename_stat_hook)
-        {
-          fn = savestring (filename);
-	  (*rl_filename_stat_hook) (&fn);
-	  xfree (filename);
-	  filename = fn;
-        }
-      s = (nontrivial_match && rl_completion_mark_symlink_dirs == 0)
-		? LSTAT (filename, &finfo)
-		: stat (filename, &finfo);
-      if (s == 0 && S_ISDIR (finfo.st_mode))
-	{
-	  if (_rl_complete_mark_directories /* && rl_completion_suppress_append == 0 */)
-	    {
-	      /* This is clumsy.  Avoid putting in a double slash if point
-		 is at the end of the line and the previous character is a
-		 slash. */
-	      if (rl_point && rl_line_buffer[rl_point] == '\0' && rl_line_buffer[rl_point - 1] == '/')
-		;
-	      else if (rl_line_buffer[rl_point] != '/')
-		rl_insert_text ("/");
-	    }
-	}
-#ifdef S_ISLNK
-      /* Don't add anything if the filename is a symlink and resolves to a
-	 directory. */
-      else if (s == 0 && S_ISLNK (finfo.st_mode) && path_isdir (filename))
-	;
-#endif
-      else
+      if (_rl_complete_mark_directories /* && rl_completion_suppress_append == 0 */)
 	{
-	  if (rl_point == rl_end && temp_string_index)
-	    rl_insert_text (temp_string);
+	  /* This is clumsy.  Avoid putting in a double slash if point
+	     is at the end of the line and the previous character is a
+	     slash. */
+	  if (rl_point && rl_line_buffer[rl_point] == '\0' && rl_line_buffer[rl_point - 1] == '/')
+	    ;
+	  else if (rl_line_buffer[rl_point] != '/')
+	    rl_insert_text ("/");
 	}
-      xfree (filename);
     }
-  else
+  else if (type == APPEND_SEPARATOR)
     {
       if (rl_point == rl_end && temp_string_index)
 	rl_insert_text (temp_string);
@@ -1969,36 +3448,21 @@ insert_all_matches (matches, point, qc)
      int point;
      char *qc;
 {
-  int i;
   char *rp;
 
   rl_begin_undo_group ();
-  /* remove any opening quote character; make_quoted_replacement will add
-     it back. */
+  /* remove any opening quote character; quote_match_list will add it
+     back. */
   if (qc && *qc && point && rl_line_buffer[point - 1] == *qc)
     point--;
   rl_delete_text (point, rl_point);
   rl_point = point;
 
-  if (matches[1])
-    {
-      for (i = 1; matches[i]; i++)
-	{
-	  rp = make_quoted_replacement (matches[i], SINGLE_MATCH, qc);
-	  rl_insert_text (rp);
-	  rl_insert_text (" ");
-	  if (rp != matches[i])
-	    xfree (rp);
-	}
-    }
-  else
-    {
-      rp = make_quoted_replacement (matches[0], SINGLE_MATCH, qc);
-      rl_insert_text (rp);
-      rl_insert_text (" ");
-      if (rp != matches[0])
-	xfree (rp);
-    }
+  /* Insert the matches all at once, so the line buffer grows once and
+     there's a single undo record no matter how many there are. */
+  rp = quote_match_list (matches[1] ? matches + 1 : matches, qc);
+  rl_insert_text (rp);
+  xfree (rp);
   rl_end_undo_group ();
 }
 
@@ -2012,7 +3476,7 @@ _rl_free_match_list (matches)
     return;
 
   for (i = 0; matches[i]; i++)
-    xfree (matches[i]);
+    free_match (matches[i]);
   xfree (matches);
 }
 
@@ -2031,13 +3495,15 @@ rl_complete_internal (what_to_do)
 {
   char **matches;
   rl_compentry_func_t *our_func;
-  int start, end, delimiter, found_quote, i, nontrivial_lcd;
+  int start, end, delimiter, found_quote;
   char *text, *saved_line_buffer;
   char quote_char;
-#if 1
-  int tlen, mlen;
+#if defined (COMPLETION_ASYNC)
+  ASYNC_COMPLETION *job;
 #endif
 
+  COMPLETION_EXCLUSIVE ();
+
   RL_SETSTATE(RL_STATE_COMPLETING);
 
   set_completion_defaults (what_to_do);
@@ -2060,7 +3526,69 @@ rl_complete_internal (what_to_do)
   rl_point = end;
 
   text = rl_copy_text (start, end);
-  matches = gen_completion_matches (text, start, end, our_func, found_quote, quote_char);
+
+#if defined (COMPLETION_ASYNC)
+  /* If the application is using the callback interface, have the
+     completion thread generate the matches and return to the application
+     right away.  Not if there are keys already waiting, like the rest of
+     a macro, since the next key would cancel the completion.  Only
+     readline's own filename completion runs on the thread: the
+     application's generators read rl_line_buffer and rl_point, which
+     change as the user goes on typing. */
+  if (rl_completion_async && saved_line_buffer &&
+      rl_attempted_completion_function == 0 &&
+      our_func == rl_filename_completion_function &&
+      RL_ISSTATE (RL_STATE_CALLBACK) && RL_ISSTATE (RL_STATE_MACROINPUT) == 0 &&
+      rl_pending_input == 0 && _rl_pushed_input_available () == 0)
+    {
+      job = (ASYNC_COMPLETION *)xmalloc (sizeof (ASYNC_COMPLETION));
+      job->text = text;
+      job->line = saved_line_buffer;
+      job->start = start;
+      job->end = end;
+      job->func = our_func;
+      job->found_quote = found_quote;
+      job->quote_char = quote_char;
+      job->delimiter = delimiter;
+      job->what_to_do = what_to_do;
+      job->matches = (char **)NULL;
+
+      _rl_reset_completion_state ();
+      if (queue_async_completion (job) == 0)
+	{
+	  completion_changed_buffer = 0;
+	  RL_UNSETSTATE(RL_STATE_COMPLETING);
+	  return 0;
+	}
+      xfree (job);
+      rl_completion_found_quote = found_quote;
+      rl_completion_quote_character = quote_char;
+    }
+#endif
+
+  matches = gen_completion_matches (text, start, end, our_func, found_quote, quote_char, rl_line_buffer);
+  return (complete_with_matches (matches, text, start, delimiter, quote_char, what_to_do, saved_line_buffer));
+}
+
+/* Do what WHAT_TO_DO says with MATCHES, the list of matches generated for
+   TEXT, which starts at START.  DELIMITER and QUOTE_CHAR are what
+   _rl_find_completion_word found.  SAVED_LINE_BUFFER is the contents of
+   the line before we started.  This frees TEXT and SAVED_LINE_BUFFER. */
+static int
+complete_with_matches (matches, text, start, delimiter, quote_char, what_to_do, saved_line_buffer)
+     char **matches;
+     char *text;
+     int start, delimiter, quote_char, what_to_do;
+     char *saved_line_buffer;
+{
+  int i, nontrivial_lcd;
+  char qc;
+#if 1
+  int tlen, mlen;
+#endif
+
+  qc = quote_char;
+
   /* nontrivial_lcd is set if the common prefix adds something to the word
      being completed. */
   nontrivial_lcd = matches && strcmp (text, matches[0]) != 0;
@@ -2102,16 +3630,16 @@ rl_complete_internal (what_to_do)
       if (what_to_do == TAB)
         {
           if (*matches[0])
-	    insert_match (matches[0], start, matches[1] ? MULT_MATCH : SINGLE_MATCH, &quote_char);
+	    insert_match (matches[0], start, matches[1] ? MULT_MATCH : SINGLE_MATCH, &qc);
         }
       else if (*matches[0] && matches[1] == 0)
 	/* should we perform the check only if there are multiple matches? */
-	insert_match (matches[0], start, matches[1] ? MULT_MATCH : SINGLE_MATCH, &quote_char);
+	insert_match (matches[0], start, matches[1] ? MULT_MATCH : SINGLE_MATCH, &qc);
       else if (*matches[0])	/* what_to_do != TAB && multiple matches */
 	{
 	  mlen = *matches[0] ? strlen (matches[0]) : 0;
 	  if (mlen >= tlen)
-	    insert_match (matches[0], start, matches[1] ? MULT_MATCH : SINGLE_MATCH, &quote_char);
+	    insert_match (matches[0], start, matches[1] ? MULT_MATCH : SINGLE_MATCH, &qc);
 	}
 
       /* If there are more matches, ring the bell to indicate.
@@ -2139,12 +3667,12 @@ rl_complete_internal (what_to_do)
 	    rl_ding ();	/* There are other matches remaining. */
 	}
       else
-	append_to_match (matches[0], delimiter, quote_char, nontrivial_lcd);
+	append_to_match (matches[0], delimiter, qc, nontrivial_lcd);
 
       break;
 
     case '*':
-      insert_all_matches (matches, start, &quote_char);
+      insert_all_matches (matches, start, &qc);
       break;
 
     case '?':
@@ -2192,6 +3720,291 @@ rl_complete_internal (what_to_do)
   return 0;
 }
 
+#if defined (COMPLETION_ASYNC)
+/* **************************************************************** */
+/*								    */
+/*		    Generating Matches Asynchronously		    */
+/*								    */
+/* **************************************************************** */
+
+static int
+on_completion_thread ()
+{
+  return (async_thread_started > 0 && pthread_equal (pthread_self (), async_thread));
+}
+
+static void
+free_async_completion (job)
+     ASYNC_COMPLETION *job;
+{
+  FREE (job->text);
+  FREE (job->line);
+  if (job->matches)
+    _rl_free_match_list (job->matches);
+  xfree (job);
+}
+
+/* Throw away whatever is in the pipe the completion thread uses to say
+   it has finished. */
+static void
+drain_async_pipe ()
+{
+  char buf[16];
+
+  while (read (async_pipe[0], buf, sizeof (buf)) > 0)
+    ;
+}
+
+/* The completion thread.  Signals are blocked, so they're always handled
+   by the application's thread. */
+static void *
+async_completion_thread (arg)
+     void *arg;
+{
+  ASYNC_COMPLETION *job;
+  sigset_t set;
+  char c;
+
+  sigfillset (&set);
+  pthread_sigmask (SIG_BLOCK, &set, (sigset_t *)NULL);
+
+  pthread_mutex_lock (&async_lock);
+  for (;;)
+    {
+      while (async_queued == 0)
+	pthread_cond_wait (&async_cond, &async_lock);
+
+      job = async_running = async_queued;
+      async_queued = 0;
+      async_cancelled = async_nmatches = 0;
+      pthread_mutex_unlock (&async_lock);
+
+      job->matches = gen_completion_matches (job->text, job->start, job->end,
+					     job->func, job->found_quote,
+					     job->quote_char, job->line);
+
+      pthread_mutex_lock (&async_lock);
+      async_running = 0;
+      if (async_cancelled)
+	free_async_completion (job);
+      else
+	{
+	  async_done = job;
+	  c = 1;
+	  /* If the pipe is full, the application has a byte to read
+	     already. */
+	  while (write (async_pipe[1], &c, 1) < 0 && errno == EINTR)
+	    ;
+	}
+      pthread_cond_broadcast (&async_cond);
+    }
+
+  /*NOTREACHED*/
+  return ((void *)NULL);
+}
+
+/* Start the completion thread if it's not running.  Returns 0 if it is
+   running, -1 if it can't be started. */
+static int
+start_completion_thread ()
+{
+  int i, flags;
+
+  if (async_thread_started)
+    return (async_thread_started > 0 ? 0 : -1);
+
+  async_thread_started = -1;
+  if (pipe (async_pipe) < 0)
+    {
+      async_pipe[0] = async_pipe[1] = -1;
+      return -1;
+    }
+  for (i = 0; i < 2; i++)
+    {
+      flags = fcntl (async_pipe[i], F_GETFL, 0);
+      fcntl (async_pipe[i], F_SETFL, flags | O_NONBLOCK);
+#if defined (FD_CLOEXEC)
+      fcntl (async_pipe[i], F_SETFD, FD_CLOEXEC);
+#endif
+    }
+
+  if (pthread_create (&async_thread, (pthread_attr_t *)NULL, async_completion_thread, (void *)NULL) != 0)
+    {
+      close (async_pipe[0]);
+      close (async_pipe[1]);
+      async_pipe[0] = async_pipe[1] = -1;
+      return -1;
+    }
+  pthread_detach (async_thread);
+  async_thread_started = 1;
+  return 0;
+}
+
+/* Give JOB to the completion thread, replacing any request it hasn't
+   finished.  Returns -1 if there is no completion thread. */
+static int
+queue_async_completion (job)
+     ASYNC_COMPLETION *job;
+{
+  if (start_completion_thread () < 0)
+    return -1;
+
+  _rl_complete_async_cancel ();
+
+  pthread_mutex_lock (&async_lock);
+  async_queued = job;
+  pthread_cond_broadcast (&async_cond);
+  pthread_mutex_unlock (&async_lock);
+  return 0;
+}
+
+/* Cancel any request the completion thread has, and wait for it to stop
+   running the generators. */
+static void
+wait_for_async_completion ()
+{
+  int idle;
+
+  if (async_thread_started <= 0)
+    return;
+
+  /* This is called each time a generator starts, so don't bother
+     draining the pipe if there's nothing to cancel. */
+  pthread_mutex_lock (&async_lock);
+  idle = async_queued == 0 && async_running == 0 && async_done == 0;
+  pthread_mutex_unlock (&async_lock);
+  if (idle)
+    return;
+
+  _rl_complete_async_cancel ();
+
+  pthread_mutex_lock (&async_lock);
+  while (async_running)
+    pthread_cond_wait (&async_cond, &async_lock);
+  pthread_mutex_unlock (&async_lock);
+}
+#endif /* COMPLETION_ASYNC */
+
+/* Return non-zero if there is a completion request the completion thread
+   is working on or has finished. */
+int
+_rl_complete_async_pending ()
+{
+#if defined (COMPLETION_ASYNC)
+  int r;
+
+  if (async_thread_started <= 0)
+    return 0;
+  pthread_mutex_lock (&async_lock);
+  r = async_queued || (async_running && async_cancelled == 0) || async_done;
+  pthread_mutex_unlock (&async_lock);
+  return r;
+#else
+  return 0;
+#endif
+}
+
+/* Cancel the completion request the completion thread is working on, and
+   throw away any results it has finished. */
+void
+_rl_complete_async_cancel ()
+{
+#if defined (COMPLETION_ASYNC)
+  if (async_thread_started <= 0)
+    return;
+
+  pthread_mutex_lock (&async_lock);
+  if (async_queued)
+    free_async_completion (async_queued);
+  if (async_done)
+    free_async_completion (async_done);
+  async_queued = async_done = 0;
+  if (async_running)
+    async_cancelled = 1;
+  pthread_mutex_unlock (&async_lock);
+
+  drain_async_pipe ();
+#endif
+}
+
+/* If the completion thread has finished generating matches, insert or
+   display them as the completion command that asked for them would have.
+   Returns 1 if there were results, 0 if not. */
+int
+_rl_complete_async_finish ()
+{
+#if defined (COMPLETION_ASYNC)
+  ASYNC_COMPLETION *job;
+
+  if (async_thread_started <= 0)
+    return 0;
+
+  pthread_mutex_lock (&async_lock);
+  job = async_done;
+  async_done = 0;
+  pthread_mutex_unlock (&async_lock);
+  if (job == 0)
+    return 0;
+
+  drain_async_pipe ();
+
+  /* If the application changed the line in the meantime, the matches
+     don't apply any more. */
+  if (rl_point != job->end || strcmp (rl_line_buffer, job->line) != 0)
+    {
+      free_async_completion (job);
+      return 1;
+    }
+
+  RL_SETSTATE(RL_STATE_COMPLETING);
+  rl_completion_found_quote = job->found_quote;
+  rl_completion_quote_character = job->quote_char;
+  complete_with_matches (job->matches, job->text, job->start, job->delimiter,
+			 job->quote_char, job->what_to_do, job->line);
+  xfree (job);
+  return 1;
+#else
+  return 0;
+#endif
+}
+
+/* Return a file descriptor that becomes readable when completion matches
+   generated asynchronously are ready, starting the completion thread if
+   necessary, or -1 if matches can't be generated asynchronously. */
+int
+rl_completion_async_fd ()
+{
+#if defined (COMPLETION_ASYNC)
+  return (start_completion_thread () == 0 ? async_pipe[0] : -1);
+#else
+  return -1;
+#endif
+}
+
+/* Return the number of matches found so far for the pending asynchronous
+   completion, or -1 if there is none. */
+int
+rl_completion_async_progress ()
+{
+#if defined (COMPLETION_ASYNC)
+  int r;
+
+  if (async_thread_started <= 0)
+    return -1;
+  pthread_mutex_lock (&async_lock);
+  if (async_done)
+    r = async_nmatches;
+  else if (async_queued)
+    r = 0;
+  else
+    r = (async_running && async_cancelled == 0) ? async_nmatches : -1;
+  pthread_mutex_unlock (&async_lock);
+  return r;
+#else
+  return -1;
+#endif
+}
+
 /***************************************************************/
 /*							       */
 /*  Application-callable completion match generator functions  */
@@ -2214,6 +4027,18 @@ char **
 rl_completion_matches (text, entry_function)
      const char *text;
      rl_compentry_func_t *entry_function;
+{
+  return (completion_matches (text, entry_function, 0));
+}
+
+/* Do the work of rl_completion_matches.  If POOLED is non-zero, the list
+   won't be given to the application, so if ENTRY_FUNCTION is
+   rl_filename_completion_function it can put the matches in an arena. */
+static char **
+completion_matches (text, entry_function, pooled)
+     const char *text;
+     rl_compentry_func_t *entry_function;
+     int pooled;
 {
   register int i;
 
@@ -2229,14 +4054,38 @@ rl_completion_matches (text, entry_function)
   /* Temporary string binder. */
   char *string;
 
-  matches = 0;
-  match_list_size = 10;
+  /* The most matches we keep, the number we didn't keep, and the length
+     of the prefix common to the ones we kept. */
+  int limit, omitted, low;
+
+  /* The number of matches other lists left out that we add ours to. */
+  int outer_omitted;
+
+  /* Where the matches come from, and where they came from before, in case
+     a hook the generator calls wants matches of its own. */
+  MATCH_ARENA *arena, *outer;
+
+  COMPLETION_EXCLUSIVE ();
+
+  outer = filling_arena;
+  arena = filling_arena = (pooled && entry_function == rl_filename_completion_function) ? new_match_arena () : (MATCH_ARENA *)NULL;
+  /* A generator that asks for matches of its own mustn't change the
+     count for ours. */
+  outer_omitted = completion_attempt_depth ? rl_completion_matches_omitted : 0;
+
+  matches = omitted = 0;
+  limit = completion_match_limit ();
+  low = -1;
+  match_list_size = MATCH_LIST_INITIAL_SIZE;
   match_list = (char **)xmalloc ((match_list_size + 1) * sizeof (char *));
   match_list[1] = (char *)NULL;
+  FREE (fuzzy_pattern);
+  fuzzy_pattern = (char *)NULL;
+  _rl_completion_nonprefix = 0;
 
-  while (string = (*entry_function) (text, matches))
+  while (string = (*entry_function) (text, matches + omitted))
     {
-      if (RL_SIG_RECEIVED ())
+      if (COMPLETION_INTERRUPTED ())
 	{
 	  /* Start at 1 because we don't set matches[0] in this function.
 	     Only free the list members if we're building match list from
@@ -2245,64 +4094,425 @@ rl_completion_matches (text, entry_function)
 	  if (entry_function == rl_filename_completion_function)
 	    {
 	      for (i = 1; match_list[i]; i++)
-		xfree (match_list[i]);
+		free_match (match_list[i]);
 	    }
 	  xfree (match_list);
 	  match_list = 0;
 	  match_list_size = 0;
 	  matches = 0;
-	  RL_CHECK_SIGNALS ();
+	  COMPLETION_CHECK_SIGNALS ();
+	}
+
+      if (limit && match_list && matches >= limit)
+	{
+	  omit_match (match_list, matches, string, &low);
+	  omitted++;
+	  continue;
 	}
 
       if (matches + 1 >= match_list_size)
-	match_list = (char **)xrealloc
-	  (match_list, ((match_list_size += 10) + 1) * sizeof (char *));
+	match_list = grow_match_list (match_list, &match_list_size, matches + 2);
 
       if (match_list == 0)
-	return (match_list);
+	break;
 
       match_list[++matches] = string;
       match_list[matches + 1] = (char *)NULL;
+#if defined (COMPLETION_ASYNC)
+      if (on_completion_thread ())
+	async_nmatches = matches + omitted;
+#endif
     }
 
-  /* If there were any matches, then look through them finding out the
-     lowest common denominator.  That then becomes match_list[0]. */
-  if (matches)
-    compute_lcd_of_matches (match_list, matches, text);
-  else				/* There were no matches. */
-    {
-      xfree (match_list);
-      match_list = (char **)NULL;
-    }
-  return (match_list);
+  filling_arena = outer;
+  end_match_arena (arena);
+  rl_completion_matches_omitted = outer_omitted + (match_list ? omitted : 0);
+  if (match_list == 0)
+    return (match_list);
+
+  return (finish_match_list (match_list, matches, text));
 }
 
-/* A completion function for usernames.
-   TEXT contains a partial username preceded by a random
-   character (usually `~').  */
-char *
-rl_username_completion_function (text, state)
+/* Like rl_completion_matches, but ENTRY_FUNCTION returns a NULL-terminated
+   array of matches on each call rather than a single match, so generators
+   that produce many matches at once need not be called once per match.
+   The second argument to ENTRY_FUNCTION is zero on the first call and the
+   number of matches returned so far on subsequent calls.  ENTRY_FUNCTION
+   returns NULL or an empty array when there are no more matches.  The
+   matches become part of the returned list; the arrays holding them are
+   freed. */
+char **
+rl_completion_matches_batch (text, entry_function)
      const char *text;
-     int state;
+     rl_compentry_batch_func_t *entry_function;
 {
-  static char *username = (char *)NULL;
-#ifndef _WIN32
-  static struct passwd *entry;
-#else
-  char user_name[128];
-  DWORD user_len;
-#endif
-  static int namelen, first_char, first_char_loc;
-  char *value;
+  register int i, n, keep;
+  int match_list_size, matches, limit, omitted, low, outer_omitted;
+  char **match_list, **batch;
 
-#if defined (__OPENNT)
-  return (char *)NULL;
-#elif defined (_WIN32)
-  if (GetUserNameA (user_name, &user_len))
+  COMPLETION_EXCLUSIVE ();
+
+  outer_omitted = completion_attempt_depth ? rl_completion_matches_omitted : 0;
+
+  matches = omitted = 0;
+  limit = completion_match_limit ();
+  low = -1;
+  match_list_size = MATCH_LIST_INITIAL_SIZE;
+  match_list = (char **)xmalloc ((match_list_size + 1) * sizeof (char *));
+  match_list[1] = (char *)NULL;
+  FREE (fuzzy_pattern);
+  fuzzy_pattern = (char *)NULL;
+  _rl_completion_nonprefix = 0;
+
+  while ((batch = (*entry_function) (text, matches + omitted)) && batch[0])
     {
-      if (namelen == 0 || (!strnicmp (username, user_name, namelen)))
+      if (COMPLETION_INTERRUPTED ())
 	{
-	  value = (char *)xmalloc (2 + strlen (user_name));
+	  /* We own the matches, so free everything we've collected. */
+	  for (i = 1; i <= matches; i++)
+	    xfree (match_list[i]);
+	  for (i = 0; batch[i]; i++)
+	    xfree (batch[i]);
+	  xfree (batch);
+	  xfree (match_list);
+	  rl_completion_matches_omitted = outer_omitted;
+	  COMPLETION_CHECK_SIGNALS ();
+	  return ((char **)NULL);
+	}
+
+      for (n = 0; batch[n]; n++)
+	;
+      keep = (limit && matches + n > limit) ? limit - matches : n;
+      if (matches + keep + 1 >= match_list_size)
+	match_list = grow_match_list (match_list, &match_list_size, matches + keep + 2);
+
+      memcpy (match_list + matches + 1, batch, keep * sizeof (char *));
+      matches += keep;
+      match_list[matches + 1] = (char *)NULL;
+      for (i = keep; i < n; i++)
+	omit_match (match_list, matches, batch[i], &low);
+      omitted += n - keep;
+      xfree (batch);
+#if defined (COMPLETION_ASYNC)
+      if (on_completion_thread ())
+	async_nmatches = matches + omitted;
+#endif
+    }
+  FREE (batch);
+
+  rl_completion_matches_omitted = outer_omitted + omitted;
+  return (finish_match_list (match_list, matches, text));
+}
+
+/* Return a new arena to generate matches in. */
+static MATCH_ARENA *
+new_match_arena ()
+{
+  MATCH_ARENA *a;
+
+  a = (MATCH_ARENA *)xmalloc (sizeof (MATCH_ARENA));
+  a->blocks = (ARENA_BLOCK *)NULL;
+  a->last = (char *)NULL;
+  a->live = 0;
+  a->filling = 1;
+  LOCK_ARENAS ();
+  a->next = match_arenas;
+  match_arenas = a;
+  UNLOCK_ARENAS ();
+  return a;
+}
+
+/* Return N bytes from arena A.  Each block is twice the size of the one
+   before, up to ARENA_BLOCK_MAX, so a list of matches takes a handful. */
+static char *
+arena_alloc (a, n)
+     MATCH_ARENA *a;
+     size_t n;
+{
+  ARENA_BLOCK *b;
+  size_t size;
+
+  b = a->blocks;
+  if (b == 0 || b->size - b->used < n)
+    {
+      size = b ? b->size * 2 : ARENA_BLOCK_SIZE;
+      if (size > ARENA_BLOCK_MAX)
+	size = ARENA_BLOCK_MAX;
+      if (size < n)
+	size = n;
+      b = (ARENA_BLOCK *)xmalloc (sizeof (ARENA_BLOCK) + size);
+      b->data = (char *)(b + 1);
+      b->size = size;
+      b->used = 0;
+      LOCK_ARENAS ();
+      b->next = a->blocks;
+      a->blocks = b;
+      UNLOCK_ARENAS ();
+    }
+
+  a->last = b->data + b->used;
+  b->used += n;
+  a->live++;
+  return (a->last);
+}
+
+static void
+free_arena_blocks (a)
+     MATCH_ARENA *a;
+{
+  ARENA_BLOCK *b, *next;
+
+  for (b = a->blocks; b; b = next)
+    {
+      next = b->next;
+      xfree (b);
+    }
+  xfree (a);
+}
+
+/* Matches are no longer being generated in arena A.  If none of them
+   were kept, free it. */
+static void
+end_match_arena (a)
+     MATCH_ARENA *a;
+{
+  MATCH_ARENA **ap;
+
+  if (a == 0)
+    return;
+
+  LOCK_ARENAS ();
+  a->filling = 0;
+  if (a->live)
+    a = (MATCH_ARENA *)NULL;
+  else
+    {
+      for (ap = &match_arenas; *ap != a; ap = &(*ap)->next)
+	;
+      *ap = a->next;
+    }
+  UNLOCK_ARENAS ();
+
+  if (a)
+    free_arena_blocks (a);
+}
+
+/* Free the match S, which is either in an arena or was allocated with
+   malloc. */
+static void
+free_match (s)
+     char *s;
+{
+  MATCH_ARENA *a, **ap;
+  ARENA_BLOCK *b;
+
+  LOCK_ARENAS ();
+  for (ap = &match_arenas, b = (ARENA_BLOCK *)NULL; (a = *ap); ap = &a->next)
+    {
+      for (b = a->blocks; b; b = b->next)
+	if (s >= b->data && s < b->data + b->used)
+	  break;
+      if (b)
+	break;
+    }
+  /* The most recent string is at the end of the newest block, so while
+     the arena is filling its space can be used again. */
+  if (a && a->filling && s == a->last)
+    {
+      b->used = s - b->data;
+      a->last = (char *)NULL;
+    }
+  if (a && --a->live == 0 && a->filling == 0)
+    *ap = a->next;
+  else
+    b = (ARENA_BLOCK *)NULL;	/* nothing to free */
+  UNLOCK_ARENAS ();
+
+  if (a == 0)
+    xfree (s);
+  else if (b)
+    free_arena_blocks (a);
+}
+
+/* If the match S is in an arena, add a reference to it, which is dropped
+   by passing S to free_match, and return 1.  Otherwise return 0. */
+static int
+hold_match (s)
+     char *s;
+{
+  MATCH_ARENA *a;
+  ARENA_BLOCK *b;
+
+  LOCK_ARENAS ();
+  for (a = match_arenas, b = (ARENA_BLOCK *)NULL; a; a = a->next)
+    {
+      for (b = a->blocks; b; b = b->next)
+	if (s >= b->data && s < b->data + b->used)
+	  break;
+      if (b)
+	break;
+    }
+  if (a)
+    a->live++;
+  UNLOCK_ARENAS ();
+
+  return (a != 0);
+}
+
+/* Replace the matches in MATCHES that are in arenas with copies allocated
+   with malloc, so the application can free them. */
+static void
+unpool_match_list (matches)
+     char **matches;
+{
+  char *t;
+  register int i;
+  int pooled;
+
+  LOCK_ARENAS ();
+  pooled = match_arenas != 0;
+  UNLOCK_ARENAS ();
+  if (pooled == 0)
+    return;
+  for (i = 0; matches[i]; i++)
+    {
+      t = savestring (matches[i]);
+      free_match (matches[i]);
+      matches[i] = t;
+    }
+}
+
+/* Allocate N bytes for a match from rl_filename_completion_function. */
+static char *
+match_alloc (n)
+     size_t n;
+{
+  return (filling_arena ? arena_alloc (filling_arena, n) : (char *)xmalloc (n));
+}
+
+/* Make sure the match list LIST has room for at least NEED entries plus
+   the terminating NULL, updating *SIZEP.  The list at least doubles in
+   size each time, so appending N matches one at a time takes O(N) time
+   overall. */
+static char **
+grow_match_list (list, sizep, need)
+     char **list;
+     int *sizep, need;
+{
+  int size;
+
+  size = (*sizep > 0) ? *sizep : MATCH_LIST_INITIAL_SIZE;
+  while (size < need)
+    size *= 2;
+  *sizep = size;
+  return ((char **)xrealloc (list, (size + 1) * sizeof (char *)));
+}
+
+/* Return the most matches rl_completion_matches should keep, or 0 if
+   there is no limit. */
+static int
+completion_match_limit ()
+{
+  if (rl_completion_max_matches <= 0)
+    return 0;
+  /* With only one match, completion would think it was unique. */
+  return (rl_completion_max_matches < 2 ? 2 : rl_completion_max_matches);
+}
+
+/* MATCH_LIST holds N matches, as many as we keep.  STRING is another
+   match, which we count but don't keep, unless it has less in common with
+   the first match than any of the ones we kept.  Then it replaces the last
+   one, so the lowest common denominator of the list is the same as if we
+   had kept every match.  *LOWP is the length of the prefix the matches we
+   kept have in common, or -1 if we haven't computed it yet. */
+static void
+omit_match (match_list, n, string, lowp)
+     char **match_list;
+     int n;
+     char *string;
+     int *lowp;
+{
+  register int i;
+  int low, fold;
+
+  fold = _rl_completion_case_fold;
+  low = *lowp;
+  if (low < 0)
+    {
+      low = strlen (match_list[1]);
+      for (i = 2; i <= n && low > 0; i++)
+	low = byte_prefix_length (match_list[1], match_list[i], low, fold);
+    }
+
+  i = byte_prefix_length (match_list[1], string, low, fold);
+  if (i < low)
+    {
+      free_match (match_list[n]);
+      match_list[n] = string;
+      low = i;
+    }
+  else
+    free_match (string);
+
+  *lowp = low;
+}
+
+/* Finish building a match list of MATCHES matches for TEXT: if there
+   were any matches, then look through them finding out the lowest common
+   denominator.  That then becomes match_list[0].  If there were no
+   matches, free the list and return NULL. */
+static char **
+finish_match_list (match_list, matches, text)
+     char **match_list;
+     int matches;
+     const char *text;
+{
+  if (matches)
+    {
+      compute_lcd_of_matches (match_list, matches, text);
+      if (_rl_completion_nonprefix)
+	keep_typed_text (match_list, text);
+      if (fuzzy_pattern)
+	rank_fuzzy_matches (match_list, matches, text);
+    }
+  else				/* There were no matches. */
+    {
+      xfree (match_list);
+      match_list = (char **)NULL;
+    }
+  FREE (fuzzy_pattern);
+  fuzzy_pattern = (char *)NULL;
+  _rl_completion_nonprefix = 0;
+  return (match_list);
+}
+
+/* A completion function for usernames.
+   TEXT contains a partial username preceded by a random
+   character (usually `~').  */
+char *
+rl_username_completion_function (text, state)
+     const char *text;
+     int state;
+{
+  static char *username = (char *)NULL;
+#ifndef _WIN32
+  static char **users;
+  static int nusers, uind;
+#else
+  char user_name[128];
+  DWORD user_len;
+#endif
+  static int namelen, first_char, first_char_loc;
+  char *value;
+
+#if defined (__OPENNT)
+  return (char *)NULL;
+#elif defined (_WIN32)
+  if (GetUserNameA (user_name, &user_len))
+    {
+      if (namelen == 0 || (!strnicmp (username, user_name, namelen)))
+	{
+	  value = (char *)xmalloc (2 + strlen (user_name));
 	  *value = *text;
 	  strcpy (value + first_char_loc, user_name);
 	  if (first_char == '~')
@@ -2310,187 +4520,1250 @@ rl_username_completion_function (text, state)
 	  return (value);
 	}
     }
-  return ((char *)NULL);
-#else /* !__WIN32__ && !__OPENNT) */
+  return ((char *)NULL);
+#else /* !__WIN32__ && !__OPENNT) */
+
+  if (state == 0)
+    {
+      COMPLETION_EXCLUSIVE ();
+
+      FREE (username);
+
+      first_char = *text;
+      first_char_loc = first_char == '~';
+
+      username = savestring (&text[first_char_loc]);
+      namelen = strlen (username);
+
+      /* The users are kept sorted by name, so the ones that match are
+	 together.  Null usernames should result in all users as possible
+	 completions. */
+      nusers = tilde_find_users (username, namelen, &users);
+      uind = 0;
+    }
+
+  if (uind >= nusers)
+    return ((char *)NULL);
+  else
+    {
+      value = (char *)xmalloc (2 + strlen (users[uind]));
+
+      *value = *text;
+
+      strcpy (value + first_char_loc, users[uind]);
+      uind++;
+
+      if (first_char == '~')
+	rl_filename_completion_desired = 1;
+
+      return (value);
+    }
+#endif /* !__WIN32__ && !__OPENNT */
+}
+
+/* Return non-zero if CONVFN matches FILENAME up to the length of FILENAME
+   (FILENAME_LEN).  If _rl_completion_case_fold is set, compare without
+   regard to the alphabetic case of characters.  If
+   _rl_completion_case_map is set, make `-' and `_' equivalent.  CONVFN is
+   the possibly-converted directory entry; FILENAME is what the user typed. */
+static int
+complete_fncmp (convfn, convlen, filename, filename_len)
+     const char *convfn;
+     int convlen;
+     const char *filename;
+     int filename_len;
+{
+  register char *s1, *s2;
+  int d, len;
+#if defined (HANDLE_MULTIBYTE)
+  size_t v1, v2;
+  mbstate_t ps1, ps2;
+  wchar_t wc1, wc2;
+#endif
+
+#if defined (HANDLE_MULTIBYTE)
+  memset (&ps1, 0, sizeof (mbstate_t));
+  memset (&ps2, 0, sizeof (mbstate_t));
+#endif
+
+  if (filename_len == 0)
+    return 1;
+  if (convlen < filename_len)
+    return 0;
+
+  len = filename_len;
+  s1 = (char *)convfn;
+  s2 = (char *)filename;
+
+  /* Otherwise, if these match up to the length of filename, then
+     it is a match. */
+  if (_rl_completion_case_fold && _rl_completion_case_map)
+    {
+      /* Case-insensitive comparison treating _ and - as equivalent */
+#if defined (HANDLE_MULTIBYTE)
+      if (MB_CUR_MAX > 1 && rl_byte_oriented == 0)
+	{
+	  do
+	    {
+	      v1 = mbrtowc (&wc1, s1, convlen, &ps1);
+	      v2 = mbrtowc (&wc2, s2, filename_len, &ps2);
+	      if (v1 == 0 && v2 == 0)
+		return 1;
+	      else if (MB_INVALIDCH (v1) || MB_INVALIDCH (v2))
+		{
+		  if (*s1 != *s2)		/* do byte comparison */
+		    return 0;
+		  else if ((*s1 == '-' || *s1 == '_') && (*s2 == '-' || *s2 == '_'))
+		    return 0;
+		  s1++; s2++; len--;
+		  continue;
+		}
+	      wc1 = towlower (wc1);
+	      wc2 = towlower (wc2);
+	      s1 += v1;
+	      s2 += v1;
+	      len -= v1;
+	      if ((wc1 == L'-' || wc1 == L'_') && (wc2 == L'-' || wc2 == L'_'))
+	        continue;
+	      if (wc1 != wc2)
+		return 0;
+	    }
+	  while (len != 0);
+	}
+      else
+#endif
+	{
+	do
+	  {
+	    d = _rl_to_lower (*s1) - _rl_to_lower (*s2);
+	    /* *s1 == [-_] && *s2 == [-_] */
+	    if ((*s1 == '-' || *s1 == '_') && (*s2 == '-' || *s2 == '_'))
+	      d = 0;
+	    if (d != 0)
+	      return 0;
+	    s1++; s2++;	/* already checked convlen >= filename_len */
+	  }
+	while (--len != 0);
+	}
+
+      return 1;
+    }
+  else if (_rl_completion_case_fold)
+    {
+#if defined (HANDLE_MULTIBYTE)
+      if (MB_CUR_MAX > 1 && rl_byte_oriented == 0)
+	{
+	  do
+	    {
+	      v1 = mbrtowc (&wc1, s1, convlen, &ps1);
+	      v2 = mbrtowc (&wc2, s2, filename_len, &ps2);
+	      if (v1 == 0 && v2 == 0)
+		return 1;
+	      else if (MB_INVALIDCH (v1) || MB_INVALIDCH (v2))
+		{
+		  if (*s1 != *s2)		/* do byte comparison */
+		    return 0;
+		  s1++; s2++; len--;
+		  continue;
+		}
+	      wc1 = towlower (wc1);
+	      wc2 = towlower (wc2);
+	      if (wc1 != wc2)
+		return 0;
+	      s1 += v1;
+	      s2 += v1;
+	      len -= v1;
+	    }
+	  while (len != 0);
+	  return 1;
+	}
+      else
+#endif
+      if ((_rl_to_lower (convfn[0]) == _rl_to_lower (filename[0])) &&
+	  (convlen >= filename_len) &&
+	  (_rl_strnicmp (filename, convfn, filename_len) == 0))
+	return 1;
+    }
+  else
+    {
+      if ((convfn[0] == filename[0]) &&
+	  (convlen >= filename_len) &&
+	  (strncmp (filename, convfn, filename_len) == 0))
+	return 1;
+    }
+  return 0;
+}
+
+#if defined (MATCH_FILE_TYPES)
+/* The file type table and the directories its entries came from. */
+static MATCH_FTYPE *match_ftypes;
+static int match_ftypes_size;		/* always a power of two */
+static int match_ftypes_count;
+
+/* The table's copies of the matches and directory entry names, which are
+   all freed together when the table is cleared. */
+static MATCH_ARENA *match_ftype_strings;
+
+static MATCH_DIR *match_dirs;
+static int match_dirs_count;
+
+static unsigned int
+match_hash (s)
+     const char *s;
+{
+  register unsigned int h;
+
+  for (h = 2166136261U; *s; s++)	/* FNV-1a */
+    h = (h ^ (unsigned char)*s) * 16777619U;
+  return h;
+}
+
+static void
+clear_match_file_types ()
+{
+  register int i;
+
+  for (i = 0; i < match_ftypes_size; i++)
+    match_ftypes[i].match = match_ftypes[i].dname = (char *)NULL;
+  match_ftypes_count = 0;
+  if (match_ftype_strings)
+    free_arena_blocks (match_ftype_strings);
+  match_ftype_strings = (MATCH_ARENA *)NULL;
+
+  for (i = 0; i < match_dirs_count; i++)
+    {
+      if (match_dirs[i].fd >= 0)
+	close (match_dirs[i].fd);
+      xfree (match_dirs[i].path);
+    }
+  FREE (match_dirs);
+  match_dirs = (MATCH_DIR *)NULL;
+  match_dirs_count = 0;
+}
+
+/* Return the index in match_dirs of the directory PATH, adding it if it's
+   not the most recent one. */
+static int
+add_match_dir (path)
+     const char *path;
+{
+  if (match_dirs_count && STREQ (match_dirs[match_dirs_count - 1].path, path))
+    return (match_dirs_count - 1);
+
+  match_dirs = (MATCH_DIR *)xrealloc (match_dirs, (match_dirs_count + 1) * sizeof (MATCH_DIR));
+  match_dirs[match_dirs_count].path = savestring (path);
+  match_dirs[match_dirs_count].fd = -1;
+  return (match_dirs_count++);
+}
+
+/* Return the slot in match_ftypes for MATCH: either the one holding it or
+   the empty one where it belongs. */
+static MATCH_FTYPE *
+match_ftype_slot (match)
+     const char *match;
+{
+  register unsigned int i, mask;
+
+  mask = match_ftypes_size - 1;
+  for (i = match_hash (match) & mask; match_ftypes[i].match; i = (i + 1) & mask)
+    if (STREQ (match_ftypes[i].match, match))
+      break;
+  return (&match_ftypes[i]);
+}
+
+static mode_t
+dtype_to_mode (dtype)
+     int dtype;
+{
+  switch (dtype)
+    {
+    case DT_REG:
+      return S_IFREG;
+    case DT_DIR:
+      return S_IFDIR;
+#if defined (DT_LNK) && defined (S_IFLNK)
+    case DT_LNK:
+      return S_IFLNK;
+#endif
+#if defined (DT_FIFO) && defined (S_IFIFO)
+    case DT_FIFO:
+      return S_IFIFO;
+#endif
+#if defined (DT_CHR) && defined (S_IFCHR)
+    case DT_CHR:
+      return S_IFCHR;
+#endif
+#if defined (DT_BLK) && defined (S_IFBLK)
+    case DT_BLK:
+      return S_IFBLK;
+#endif
+#if defined (DT_SOCK) && defined (S_IFSOCK)
+    case DT_SOCK:
+      return S_IFSOCK;
+#endif
+    default:
+      return 0;
+    }
+}
+
+/* Remember that MATCH names the directory entry DNAME, of type DTYPE, in
+   match_dirs[DIR]. */
+static void
+record_match_file_type (match, dname, dtype, dir)
+     const char *match, *dname;
+     int dtype, dir;
+{
+  MATCH_FTYPE *old, *ent;
+  int i, oldsize;
+
+  if (match_ftypes_count * 2 >= match_ftypes_size)
+    {
+      old = match_ftypes;
+      oldsize = match_ftypes_size;
+      match_ftypes_size = oldsize ? oldsize * 2 : 256;
+      match_ftypes = (MATCH_FTYPE *)xmalloc (match_ftypes_size * sizeof (MATCH_FTYPE));
+      for (i = 0; i < match_ftypes_size; i++)
+	match_ftypes[i].match = (char *)NULL;
+      for (i = 0; i < oldsize; i++)
+	if (old[i].match)
+	  *match_ftype_slot (old[i].match) = old[i];
+      FREE (old);
+    }
+
+  ent = match_ftype_slot (match);
+  if (ent->match)
+    return;
+  if (match_ftype_strings == 0)
+    {
+      match_ftype_strings = (MATCH_ARENA *)xmalloc (sizeof (MATCH_ARENA));
+      memset (match_ftype_strings, 0, sizeof (MATCH_ARENA));
+    }
+  ent->match = strcpy (arena_alloc (match_ftype_strings, strlen (match) + 1), match);
+  ent->dir = dir;
+  ent->type = dtype_to_mode (dtype);
+  ent->dname = (ent->type || dir < 0) ? (char *)NULL
+				      : strcpy (arena_alloc (match_ftype_strings, strlen (dname) + 1), dname);
+  match_ftypes_count++;
+}
+
+/* Return the type of file (the S_IFMT bits of its mode, not following
+   symbolic links) that MATCH, as returned by the filename completion
+   function, names, or 0 if we don't know. */
+static mode_t
+match_file_type (match)
+     const char *match;
+{
+  MATCH_FTYPE *ent;
+#if defined (HAVE_FSTATAT) && defined (AT_SYMLINK_NOFOLLOW)
+  MATCH_DIR *dp;
+  struct stat finfo;
+  int flags;
+#endif
+
+  if (match == 0 || match_ftypes_count == 0)
+    return 0;
+  ent = match_ftype_slot (match);
+  if (ent->match == 0)
+    return 0;
+
+#if defined (HAVE_FSTATAT) && defined (AT_SYMLINK_NOFOLLOW)
+  if (ent->type == 0 && ent->dname)
+    {
+      dp = &match_dirs[ent->dir];
+      if (dp->fd == -1)
+	{
+	  flags = O_RDONLY;
+#if defined (O_DIRECTORY)
+	  flags |= O_DIRECTORY;
+#endif
+	  dp->fd = open (dp->path, flags);
+	  if (dp->fd < 0)
+	    dp->fd = -2;
+	}
+      if (dp->fd >= 0 && fstatat (dp->fd, ent->dname, &finfo, AT_SYMLINK_NOFOLLOW) == 0)
+	ent->type = finfo.st_mode & S_IFMT;
+      xfree (ent->dname);
+      ent->dname = (char *)NULL;
+    }
+#endif
+
+  return (ent->type);
+}
+#endif /* MATCH_FILE_TYPES */
+
+/* The directory listings saved by the filename completion function.  A
+   listing is current if the directory has the same device, inode, and
+   modification time as when we read it, and we read it after the
+   modification time, so changes made in the same second we read it
+   aren't missed. */
+static DIR_LISTING dir_cache[DIR_CACHE_SIZE];
+static unsigned long dir_cache_clock;
+
+#if defined (COMPLETION_GLOB)
+/* The names from all the directories a wildcarded directory name matched.
+   This isn't kept in the cache. */
+static DIR_LISTING glob_listing;
+#endif
+
+static void
+free_dir_listing (dl)
+     DIR_LISTING *dl;
+{
+  FREE (dl->path);
+  FREE (dl->names);
+  FREE (dl->pool);
+  FREE (dl->fkeys);
+  FREE (dl->forder);
+  FREE (dl->fpool);
+  FREE (dl->cmasks);
+  memset (dl, 0, sizeof (DIR_LISTING));
+}
+
+/* Read the directory PATH, with status SBP, into DL.  Returns 0 if the
+   directory can't be read. */
+static int
+read_dir_listing (dl, path, sbp)
+     DIR_LISTING *dl;
+     const char *path;
+     struct stat *sbp;
+{
+  DIR *dir;
+  struct dirent *entry;
+  int *offsets, nnames, nsize, len;
+  size_t psize, pind;
+  char *pool;
+  register int i;
+
+  dir = opendir (path);
+  if (dir == 0)
+    return 0;
+
+  offsets = (int *)xmalloc ((nsize = 64) * sizeof (int));
+  pool = (char *)xmalloc (psize = 1024);
+  pind = nnames = 0;
+  while (entry = readdir (dir))
+    {
+      len = D_NAMLEN (entry);
+      if (pind + len + 2 > psize)
+	{
+	  while (pind + len + 2 > psize)
+	    psize *= 2;
+	  pool = (char *)xrealloc (pool, psize);
+	}
+      if (nnames == nsize)
+	offsets = (int *)xrealloc (offsets, (nsize *= 2) * sizeof (int));
+
+#if defined (MATCH_FILE_TYPES)
+      pool[pind++] = entry->d_type;
+#else
+      pool[pind++] = 0;
+#endif
+      offsets[nnames++] = pind;
+      memcpy (pool + pind, entry->d_name, len);
+      pool[pind += len] = '\0';
+      pind++;
+    }
+  closedir (dir);
+
+  dl->names = (char **)xmalloc ((nnames + 1) * sizeof (char *));
+  for (i = 0; i < nnames; i++)
+    dl->names[i] = pool + offsets[i];
+  dl->names[nnames] = (char *)NULL;
+  xfree (offsets);
+  _rl_sort_strings_bytewise (dl->names, nnames);
+
+  dl->path = savestring (path);
+  dl->dev = sbp->st_dev;
+  dl->ino = sbp->st_ino;
+  dl->mtime = sbp->st_mtime;
+  dl->ltime = time ((time_t *)NULL);
+  dl->nnames = nnames;
+  dl->pool = pool;
+  return 1;
+}
+
+/* Return a current listing of the directory PATH, reading it if we don't
+   have one.  Returns NULL if the directory can't be read. */
+static DIR_LISTING *
+get_dir_listing (path)
+     const char *path;
+{
+  struct stat finfo;
+  DIR_LISTING *dl, *slot;
+  register int i;
+
+  if (stat (path, &finfo) < 0 || S_ISDIR (finfo.st_mode) == 0)
+    return ((DIR_LISTING *)NULL);
+
+  /* Reuse the slot holding an old listing of this directory if there is
+     one, otherwise the least recently used slot. */
+  slot = (DIR_LISTING *)NULL;
+  for (i = 0; i < DIR_CACHE_SIZE; i++)
+    {
+      dl = &dir_cache[i];
+      if (dl->path && STREQ (dl->path, path))
+	{
+	  if (dl->dev == finfo.st_dev && dl->ino == finfo.st_ino &&
+	      dl->mtime == finfo.st_mtime && dl->ltime > dl->mtime)
+	    {
+	      dl->lastuse = ++dir_cache_clock;
+	      return dl;
+	    }
+	  slot = dl;
+	  break;
+	}
+      if (slot == 0 || dl->lastuse < slot->lastuse)
+	slot = dl;
+    }
+
+  free_dir_listing (slot);
+  if (read_dir_listing (slot, path, &finfo) == 0)
+    return ((DIR_LISTING *)NULL);
+  slot->lastuse = ++dir_cache_clock;
+  return slot;
+}
+
+/* Return the index of the first name in DL that isn't less than the
+   first LEN bytes of PREFIX; names starting with PREFIX follow it. */
+static int
+dir_listing_lower_bound (dl, prefix, len)
+     DIR_LISTING *dl;
+     const char *prefix;
+     int len;
+{
+  int lo, hi, mid;
+
+  lo = 0;
+  hi = dl->nnames;
+  while (lo < hi)
+    {
+      mid = lo + (hi - lo) / 2;
+      if (strncmp (dl->names[mid], prefix, len) < 0)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+  return lo;
+}
+
+/* Return the FOLD_* flags saying how filenames should be folded for
+   the current completion settings. */
+static int
+completion_fold_mode ()
+{
+  int mode;
+
+  mode = FOLD_CASE;
+  if (_rl_completion_case_map)
+    mode |= FOLD_MAP;
+#if defined (HANDLE_MULTIBYTE)
+  if (MB_CUR_MAX > 1 && rl_byte_oriented == 0)
+    mode |= FOLD_MULTIBYTE;
+#endif
+  return mode;
+}
+
+/* Fold NAME the way MODE says, so that names complete_fncmp considers
+   equal fold to the same bytes.  The result is left in *BUFP, which has
+   *SIZEP bytes and is enlarged if necessary; return its length.  Invalid
+   multibyte characters are left alone. */
+static int
+fold_completion_name (name, mode, bufp, sizep)
+     const char *name;
+     int mode;
+     char **bufp;
+     size_t *sizep;
+{
+  size_t len, need;
+  char *buf;
+  int i, o, c;
+#if defined (HANDLE_MULTIBYTE)
+  mbstate_t ps, ops;
+  size_t v, n;
+  wchar_t wc;
+#endif
+
+  len = strlen (name);
+  /* A folded multibyte character can take more bytes than the original. */
+  need = ((mode & FOLD_MULTIBYTE) ? len * MB_CUR_MAX : len) + 1;
+  if (*sizep < need)
+    {
+      *sizep = need;
+      *bufp = (char *)xrealloc (*bufp, need);
+    }
+  buf = *bufp;
+
+#if defined (HANDLE_MULTIBYTE)
+  if (mode & FOLD_MULTIBYTE)
+    {
+      memset (&ps, 0, sizeof (mbstate_t));
+      memset (&ops, 0, sizeof (mbstate_t));
+      for (i = o = 0; i < len; )
+	{
+	  v = mbrtowc (&wc, name + i, len - i, &ps);
+	  if (MB_INVALIDCH (v) || v == 0)
+	    {
+	      memset (&ps, 0, sizeof (mbstate_t));
+	      buf[o++] = name[i++];
+	      continue;
+	    }
+	  wc = towlower (wc);
+	  if ((mode & FOLD_MAP) && wc == L'_')
+	    wc = L'-';
+	  n = wcrtomb (buf + o, wc, &ops);
+	  if (n == (size_t)-1)
+	    {
+	      memset (&ops, 0, sizeof (mbstate_t));
+	      memcpy (buf + o, name + i, v);
+	      n = v;
+	    }
+	  o += n;
+	  i += v;
+	}
+      buf[o] = '\0';
+      return o;
+    }
+#endif
+
+  for (i = 0; i < len; i++)
+    {
+      c = _rl_to_lower ((unsigned char)name[i]);
+      buf[i] = ((mode & FOLD_MAP) && c == '_') ? '-' : c;
+    }
+  buf[len] = '\0';
+  return len;
+}
+
+/* The folded keys of the directory listing being sorted. */
+static char **fold_sort_keys;
+
+static int
+fold_key_compare (a, b)
+     const void *a, *b;
+{
+  return (strcmp (fold_sort_keys[*(const int *)a], fold_sort_keys[*(const int *)b]));
+}
+
+/* Fold the names in DL the way MODE says and sort them by their folded
+   keys, unless that's already been done.  The keys are kept with the
+   listing, so each name is only folded once however many times we
+   complete in the directory. */
+static void
+fold_dir_listing (dl, mode)
+     DIR_LISTING *dl;
+     int mode;
+{
+  char *buf;
+  size_t bsize, psize, pind;
+  int *offsets, i, len;
+
+  if (dl->fmode == mode)
+    return;
+
+  FREE (dl->fkeys);
+  FREE (dl->forder);
+  FREE (dl->fpool);
+
+  buf = (char *)NULL;
+  bsize = 0;
+  offsets = (int *)xmalloc ((dl->nnames + 1) * sizeof (int));
+  dl->fpool = (char *)xmalloc (psize = 1024);
+  for (i = pind = 0; i < dl->nnames; i++)
+    {
+      len = fold_completion_name (dl->names[i], mode, &buf, &bsize);
+      if (pind + len + 1 > psize)
+	{
+	  while (pind + len + 1 > psize)
+	    psize *= 2;
+	  dl->fpool = (char *)xrealloc (dl->fpool, psize);
+	}
+      offsets[i] = pind;
+      memcpy (dl->fpool + pind, buf, len + 1);
+      pind += len + 1;
+    }
+  FREE (buf);
+
+  dl->fkeys = (char **)xmalloc ((dl->nnames + 1) * sizeof (char *));
+  dl->forder = (int *)xmalloc ((dl->nnames + 1) * sizeof (int));
+  for (i = 0; i < dl->nnames; i++)
+    {
+      dl->fkeys[i] = dl->fpool + offsets[i];
+      dl->forder[i] = i;
+    }
+  dl->fkeys[dl->nnames] = (char *)NULL;
+  xfree (offsets);
+
+  fold_sort_keys = dl->fkeys;
+  qsort (dl->forder, dl->nnames, sizeof (int), fold_key_compare);
+  dl->fmode = mode;
+}
+
+/* Return the position in DL->forder of the first name whose folded key
+   isn't less than the first LEN bytes of KEY; names whose folded keys
+   start with KEY follow it. */
+static int
+folded_lower_bound (dl, key, len)
+     DIR_LISTING *dl;
+     const char *key;
+     int len;
+{
+  int lo, hi, mid;
+
+  lo = 0;
+  hi = dl->nnames;
+  while (lo < hi)
+    {
+      mid = lo + (hi - lo) / 2;
+      if (strncmp (dl->fkeys[dl->forder[mid]], key, len) < 0)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+  return lo;
+}
+
+/* Return a mask of the bytes in S; see CHAR_MASK_BIT. */
+static unsigned long
+char_mask (s)
+     const char *s;
+{
+  unsigned long m;
+
+  for (m = 0; *s; s++)
+    m |= CHAR_MASK_BIT (*s);
+  return m;
+}
+
+/* Compute the byte masks of KEYS, which are the names in DL folded as
+   MODE says, unless that's already been done. */
+static void
+mask_dir_listing (dl, keys, mode)
+     DIR_LISTING *dl;
+     char **keys;
+     int mode;
+{
+  int i;
+
+  if (dl->cmasks && dl->cmode == mode)
+    return;
+
+  FREE (dl->cmasks);
+  dl->cmasks = (unsigned long *)xmalloc ((dl->nnames + 1) * sizeof (unsigned long));
+  for (i = 0; i < dl->nnames; i++)
+    dl->cmasks[i] = char_mask (keys[i]);
+  dl->cmode = mode;
+}
+
+/* Fuzzy matching compares whole characters, so in a multibyte locale the
+   bytes of one character in the pattern can't match the bytes of two
+   different characters in a name. */
+#if defined (HANDLE_MULTIBYTE)
+#  define FUZZY_MULTIBYTE()	(MB_CUR_MAX > 1 && rl_byte_oriented == 0)
+#else
+#  define FUZZY_MULTIBYTE()	0
+#endif
+
+/* Return the number of bytes in the character at S, which isn't the
+   terminating null.  MB says whether we're handling multibyte
+   characters; invalid ones count as one byte. */
+static int
+fuzzy_char_len (s, mb)
+     const char *s;
+     int mb;
+{
+#if defined (HANDLE_MULTIBYTE)
+  mbstate_t ps;
+  size_t n;
+
+  if (mb)
+    {
+      memset (&ps, 0, sizeof (mbstate_t));
+      n = mbrlen (s, MB_CUR_MAX, &ps);
+      if (MB_INVALIDCH (n) == 0 && n > 1)
+	return ((int)n);
+    }
+#endif
+  return 1;
+}
+
+/* Return non-zero if the characters of PATTERN appear in KEY in order. */
+static int
+fuzzy_match_p (key, pattern)
+     const char *key, *pattern;
+{
+  int mb, kl, pl;
+
+  mb = FUZZY_MULTIBYTE ();
+  if (mb == 0)
+    {
+      for ( ; *pattern; pattern++)
+	{
+	  key = strchr (key, *pattern);
+	  if (key == 0)
+	    return 0;
+	  key++;
+	}
+      return 1;
+    }
+
+  for ( ; *pattern; pattern += pl)
+    {
+      pl = fuzzy_char_len (pattern, mb);
+      for (kl = 0; *key; key += kl)
+	{
+	  kl = fuzzy_char_len (key, mb);
+	  if (kl == pl && memcmp (key, pattern, pl) == 0)
+	    break;
+	}
+      if (*key == 0)
+	return 0;
+      key += kl;
+    }
+  return 1;
+}
+
+/* Scores for fuzzy matches.  Each character matched scores FUZZY_MATCH,
+   more if it follows the previous one or begins a word, and each
+   character skipped over costs FUZZY_GAP.  These count characters, not
+   bytes. */
+#define FUZZY_MATCH	16
+#define FUZZY_CONSECUTIVE	8
+#define FUZZY_WORD_START	10
+#define FUZZY_PREFIX	15
+#define FUZZY_GAP	3
+
+#define FUZZY_WORD_BREAK(c)	((c) == '/' || (c) == '.' || (c) == '_' || (c) == '-' || (c) == ' ')
+
+/* Return how well PATTERN matches KEY, or -1 if it doesn't.  We try each
+   place the first character of PATTERN appears in KEY and match the rest
+   as early as possible from there, keeping the best score.  Positions
+   are counted in characters. */
+static int
+fuzzy_score (key, pattern)
+     const char *key, *pattern;
+{
+  const char *start, *k, *p;
+  int score, best, mb, sl, kl, pl, fl;
+  int si, ki, prev, rest, sbrk, brk;
+
+  best = -1;
+  if (*pattern == 0)
+    return 0;
+
+  mb = FUZZY_MULTIBYTE ();
+  fl = fuzzy_char_len (pattern, mb);
+  /* SBRK says whether the character before START breaks words. */
+  for (start = key, si = sbrk = 0; *start; start += sl, si++)
+    {
+      sl = fuzzy_char_len (start, mb);
+      if (sl != fl || memcmp (start, pattern, fl) != 0)
+	{
+	  sbrk = sl == 1 && FUZZY_WORD_BREAK (*start);
+	  continue;
+	}
+
+      score = 0;
+      prev = -1;
+      brk = sbrk;
+      kl = 0;
+      for (k = start, ki = si, p = pattern; *p; p += pl)
+	{
+	  pl = fuzzy_char_len (p, mb);
+	  for ( ; *k; k += kl, ki++)
+	    {
+	      kl = fuzzy_char_len (k, mb);
+	      if (kl == pl && memcmp (k, p, pl) == 0)
+		break;
+	      brk = kl == 1 && FUZZY_WORD_BREAK (*k);
+	    }
+	  if (*k == 0)
+	    break;
+	  score += FUZZY_MATCH;
+	  if (ki == 0)
+	    score += FUZZY_PREFIX;
+	  if (ki == 0 || brk)
+	    score += FUZZY_WORD_START;
+	  if (prev >= 0 && ki == prev + 1)
+	    score += FUZZY_CONSECUTIVE;
+	  else
+	    score -= FUZZY_GAP * (prev >= 0 ? ki - prev - 1 : ki);
+	  prev = ki;
+	  brk = kl == 1 && FUZZY_WORD_BREAK (*k);
+	  k += kl;
+	  ki++;
+	}
+      if (*p)
+	break;		/* no later start can match either */
+      /* Prefer shorter names when the matches are otherwise as good. */
+      for (rest = 0; *k; k += fuzzy_char_len (k, mb))
+	rest++;
+      score -= rest / 4;
+      if (score > best)
+	best = score;
+      sbrk = sl == 1 && FUZZY_WORD_BREAK (*start);
+    }
+  return best;
+}
+
+struct fuzzy_rank {
+  char *match;
+  int score;
+};
+
+/* MATCHES came from a generator whose matches needn't begin with TEXT,
+   so their common prefix in MATCHES[0] may have nothing to do with what
+   the user typed.  If there are several matches and the common prefix
+   doesn't contain TEXT, use TEXT instead, so completing doesn't remove
+   characters the user typed. */
+static void
+keep_typed_text (matches, text)
+     char **matches;
+     const char *text;
+{
+  char *t;
+  int tlen;
+
+  tlen = strlen (text);
+  if (matches[0] == 0 || matches[1] == 0 || tlen == 0)
+    return;
+
+  for (t = matches[0]; *t; t++)
+    if ((_rl_completion_case_fold ? _rl_strnicmp (t, text, tlen)
+				  : strncmp (t, text, tlen)) == 0)
+      return;
+
+  free_match (matches[0]);
+  matches[0] = savestring (text);
+}
+
+static int
+fuzzy_rank_compare (a, b)
+     const void *a, *b;
+{
+  const struct fuzzy_rank *ra, *rb;
+
+  ra = (const struct fuzzy_rank *)a;
+  rb = (const struct fuzzy_rank *)b;
+  if (ra->score != rb->score)
+    return (rb->score - ra->score);
+  return (strcmp (ra->match, rb->match));
+}
+
+/* Sort the N matches in MATCHES, beginning at MATCHES[1], by how well the
+   final pathname component of each matches fuzzy_pattern, best first. */
+static void
+rank_fuzzy_matches (matches, n, text)
+     char **matches;
+     int n;
+     const char *text;
+{
+  struct fuzzy_rank *ranks;
+  char *buf, *t;
+  size_t bsize;
+  int i;
+
+  if (n < 2)
+    return;
+
+  ranks = (struct fuzzy_rank *)xmalloc (n * sizeof (struct fuzzy_rank));
+  buf = (char *)NULL;
+  bsize = 0;
+  for (i = 0; i < n; i++)
+    {
+      ranks[i].match = matches[i + 1];
+      t = strrchr (ranks[i].match, '/');
+      t = t ? t + 1 : ranks[i].match;
+      if (fuzzy_fold != FOLD_EXACT)
+	{
+	  fold_completion_name (t, fuzzy_fold, &buf, &bsize);
+	  t = buf;
+	}
+      ranks[i].score = fuzzy_score (t, fuzzy_pattern);
+    }
+  FREE (buf);
 
-  if (state == 0)
-    {
-      FREE (username);
+  qsort (ranks, n, sizeof (struct fuzzy_rank), fuzzy_rank_compare);
+  for (i = 0; i < n; i++)
+    matches[i + 1] = ranks[i].match;
+  xfree (ranks);
 
-      first_char = *text;
-      first_char_loc = first_char == '~';
+  _rl_completion_ranked = 1;
+}
 
-      username = savestring (&text[first_char_loc]);
-      namelen = strlen (username);
-#if defined (HAVE_GETPWENT)
-      setpwent ();
+#if defined (COMPLETION_GLOB)
+/* Return non-zero if S contains characters special to glob(3). */
+static int
+glob_chars_p (s)
+     const char *s;
+{
+  return (strpbrk (s, "*?[") != 0);
+}
+
+#if defined (MATCH_FILE_TYPES)
+static int
+mode_to_dtype (mode)
+     mode_t mode;
+{
+  if (S_ISDIR (mode))
+    return DT_DIR;
+  else if (S_ISREG (mode))
+    return DT_REG;
+#if defined (S_ISLNK)
+  else if (S_ISLNK (mode))
+    return DT_LNK;
+#endif
+#if defined (S_ISFIFO)
+  else if (S_ISFIFO (mode))
+    return DT_FIFO;
+#endif
+#if defined (S_ISSOCK)
+  else if (S_ISSOCK (mode))
+    return DT_SOCK;
+#endif
+  else if (S_ISCHR (mode))
+    return DT_CHR;
+  else if (S_ISBLK (mode))
+    return DT_BLK;
+  return DT_UNKNOWN;
+}
+#endif
+
+/* Read the Ith directory in DS and find the names that can match.  We
+   won't know which directory a name came from after the listings are
+   merged, so look up the types the directory entries don't tell us. */
+static void
+scan_one_dir (ds, i)
+     DIR_SCAN *ds;
+     int i;
+{
+  struct stat finfo;
+  DIR_LISTING *dl;
+  int first, last;
+#if defined (MATCH_FILE_TYPES)
+  char *path;
+  int dlen;
+  register int j;
 #endif
+
+  dl = &ds->listings[i];
+  if (stat (ds->dirs[i], &finfo) < 0 || S_ISDIR (finfo.st_mode) == 0 ||
+      read_dir_listing (dl, ds->dirs[i], &finfo) == 0)
+    {
+      ds->first[i] = ds->last[i] = 0;
+      return;
     }
 
-#if defined (HAVE_GETPWENT)
-  while (entry = getpwent ())
+  first = 0;
+  last = dl->nnames;
+  if (ds->prefix)
     {
-      /* Null usernames should result in all users as possible completions. */
-      if (namelen == 0 || (STREQN (username, entry->pw_name, namelen)))
-	break;
+      first = dir_listing_lower_bound (dl, ds->prefix, ds->prefix_len);
+      for (last = first;
+	   last < dl->nnames && strncmp (dl->names[last], ds->prefix, ds->prefix_len) == 0;
+	   last++)
+	;
     }
+  ds->first[i] = first;
+  ds->last[i] = last;
+
+#if defined (MATCH_FILE_TYPES)
+  dlen = strlen (ds->dirs[i]);
+  path = (char *)NULL;
+  for (j = first; j < last; j++)
+    if (LISTING_NAME_TYPE (dl->names[j]) == DT_UNKNOWN)
+      {
+	path = (char *)xrealloc (path, dlen + strlen (dl->names[j]) + 1);
+	strcpy (path, ds->dirs[i]);
+	strcpy (path + dlen, dl->names[j]);
+	if (LSTAT (path, &finfo) == 0)
+	  dl->names[j][-1] = mode_to_dtype (finfo.st_mode);
+      }
+  FREE (path);
 #endif
+}
+
+/* Read directories in DS until there are none left. */
+static void *
+dir_scan_worker (arg)
+     void *arg;
+{
+  DIR_SCAN *ds;
+  int i;
 
-  if (entry == 0)
+  ds = (DIR_SCAN *)arg;
+  for (;;)
     {
-#if defined (HAVE_GETPWENT)
-      endpwent ();
+#if defined (COMPLETION_THREADS)
+      pthread_mutex_lock (&ds->lock);
 #endif
-      return ((char *)NULL);
+      i = ds->next++;
+#if defined (COMPLETION_THREADS)
+      pthread_mutex_unlock (&ds->lock);
+#endif
+      if (i >= ds->ndirs)
+	break;
+      scan_one_dir (ds, i);
     }
-  else
-    {
-      value = (char *)xmalloc (2 + strlen (entry->pw_name));
-
-      *value = *text;
 
-      strcpy (value + first_char_loc, entry->pw_name);
+  return ((void *)NULL);
+}
 
-      if (first_char == '~')
-	rl_filename_completion_desired = 1;
+#if defined (COMPLETION_THREADS)
+/* Thread start routine.  Signals are blocked in the helper threads so
+   they are always handled by the thread doing the completion. */
+static void *
+dir_scan_thread (arg)
+     void *arg;
+{
+  sigset_t set;
 
-      return (value);
-    }
-#endif /* !__WIN32__ && !__OPENNT */
+  sigfillset (&set);
+  pthread_sigmask (SIG_BLOCK, &set, (sigset_t *)NULL);
+  return (dir_scan_worker (arg));
 }
+#endif
 
-/* Return non-zero if CONVFN matches FILENAME up to the length of FILENAME
-   (FILENAME_LEN).  If _rl_completion_case_fold is set, compare without
-   regard to the alphabetic case of characters.  If
-   _rl_completion_case_map is set, make `-' and `_' equivalent.  CONVFN is
-   the possibly-converted directory entry; FILENAME is what the user typed. */
-static int
-complete_fncmp (convfn, convlen, filename, filename_len)
-     const char *convfn;
-     int convlen;
-     const char *filename;
-     int filename_len;
+/* Read all the directories in DS, using several threads if there are
+   several directories, since they may be on slow file systems. */
+static void
+scan_dirs (ds)
+     DIR_SCAN *ds;
 {
-  register char *s1, *s2;
-  int d, len;
-#if defined (HANDLE_MULTIBYTE)
-  size_t v1, v2;
-  mbstate_t ps1, ps2;
-  wchar_t wc1, wc2;
+#if defined (COMPLETION_THREADS)
+  pthread_t tids[MAX_SCAN_THREADS];
+  int i, nthreads, nstarted;
 #endif
 
-#if defined (HANDLE_MULTIBYTE)
-  memset (&ps1, 0, sizeof (mbstate_t));
-  memset (&ps2, 0, sizeof (mbstate_t));
-#endif
+  ds->next = 0;
+#if defined (COMPLETION_THREADS)
+  pthread_mutex_init (&ds->lock, (pthread_mutexattr_t *)NULL);
 
-  if (filename_len == 0)
-    return 1;
-  if (convlen < filename_len)
-    return 0;
+  nthreads = (ds->ndirs < MAX_SCAN_THREADS) ? ds->ndirs : MAX_SCAN_THREADS;
 
-  len = filename_len;
-  s1 = (char *)convfn;
-  s2 = (char *)filename;
+  /* If we can't create as many threads as we want, read the directories
+     with the ones we have; the calling thread always takes part. */
+  for (nstarted = 0, i = 1; i < nthreads; i++)
+    if (pthread_create (&tids[nstarted], (pthread_attr_t *)NULL, dir_scan_thread, ds) == 0)
+      nstarted++;
+#endif
 
-  /* Otherwise, if these match up to the length of filename, then
-     it is a match. */
-  if (_rl_completion_case_fold && _rl_completion_case_map)
-    {
-      /* Case-insensitive comparison treating _ and - as equivalent */
-#if defined (HANDLE_MULTIBYTE)
-      if (MB_CUR_MAX > 1 && rl_byte_oriented == 0)
-	{
-	  do
-	    {
-	      v1 = mbrtowc (&wc1, s1, convlen, &ps1);
-	      v2 = mbrtowc (&wc2, s2, filename_len, &ps2);
-	      if (v1 == 0 && v2 == 0)
-		return 1;
-	      else if (MB_INVALIDCH (v1) || MB_INVALIDCH (v2))
-		{
-		  if (*s1 != *s2)		/* do byte comparison */
-		    return 0;
-		  else if ((*s1 == '-' || *s1 == '_') && (*s2 == '-' || *s2 == '_'))
-		    return 0;
-		  s1++; s2++; len--;
-		  continue;
-		}
-	      wc1 = towlower (wc1);
-	      wc2 = towlower (wc2);
-	      s1 += v1;
-	      s2 += v1;
-	      len -= v1;
-	      if ((wc1 == L'-' || wc1 == L'_') && (wc2 == L'-' || wc2 == L'_'))
-	        continue;
-	      if (wc1 != wc2)
-		return 0;
-	    }
-	  while (len != 0);
-	}
-      else
+  dir_scan_worker (ds);
+
+#if defined (COMPLETION_THREADS)
+  for (i = 0; i < nstarted; i++)
+    pthread_join (tids[i], (void **)NULL);
+  pthread_mutex_destroy (&ds->lock);
 #endif
-	{
-	do
-	  {
-	    d = _rl_to_lower (*s1) - _rl_to_lower (*s2);
-	    /* *s1 == [-_] && *s2 == [-_] */
-	    if ((*s1 == '-' || *s1 == '_') && (*s2 == '-' || *s2 == '_'))
-	      d = 0;
-	    if (d != 0)
-	      return 0;
-	    s1++; s2++;	/* already checked convlen >= filename_len */
-	  }
-	while (--len != 0);
-	}
+}
 
-      return 1;
-    }
-  else if (_rl_completion_case_fold)
+/* Put the names that can match from all the listings in DS into DL,
+   sorted, without duplicates.  Returns the number of names. */
+static int
+merge_dir_listings (dl, ds)
+     DIR_LISTING *dl;
+     DIR_SCAN *ds;
+{
+  char **names;
+  char *pool;
+  int nnames, len;
+  size_t psize, pind;
+  register int i, j, n;
+
+  for (i = nnames = 0; i < ds->ndirs; i++)
+    nnames += ds->last[i] - ds->first[i];
+  if (nnames == 0)
+    return 0;
+
+  names = (char **)xmalloc ((nnames + 1) * sizeof (char *));
+  for (i = n = 0; i < ds->ndirs; i++)
+    for (j = ds->first[i]; j < ds->last[i]; j++)
+      names[n++] = ds->listings[i].names[j];
+  _rl_sort_strings_bytewise (names, nnames);
+
+  /* Remove duplicates, which are next to each other now, and copy the
+     names we keep, with their types, into a single pool. */
+  for (i = n = 0, psize = 0; i < nnames; i++)
+    if (n == 0 || STREQ (names[i], names[n - 1]) == 0)
+      {
+	names[n++] = names[i];
+	psize += strlen (names[i]) + 2;
+      }
+  pool = (char *)xmalloc (psize);
+  for (i = 0, pind = 0; i < n; i++)
     {
-#if defined (HANDLE_MULTIBYTE)
-      if (MB_CUR_MAX > 1 && rl_byte_oriented == 0)
-	{
-	  do
-	    {
-	      v1 = mbrtowc (&wc1, s1, convlen, &ps1);
-	      v2 = mbrtowc (&wc2, s2, filename_len, &ps2);
-	      if (v1 == 0 && v2 == 0)
-		return 1;
-	      else if (MB_INVALIDCH (v1) || MB_INVALIDCH (v2))
-		{
-		  if (*s1 != *s2)		/* do byte comparison */
-		    return 0;
-		  s1++; s2++; len--;
-		  continue;
-		}
-	      wc1 = towlower (wc1);
-	      wc2 = towlower (wc2);
-	      if (wc1 != wc2)
-		return 0;
-	      s1 += v1;
-	      s2 += v1;
-	      len -= v1;
-	    }
-	  while (len != 0);
-	  return 1;
-	}
-      else
+      len = strlen (names[i]);
+      pool[pind++] = LISTING_NAME_TYPE (names[i]);
+      memcpy (pool + pind, names[i], len + 1);
+      names[i] = pool + pind;
+      pind += len + 1;
+    }
+  names[n] = (char *)NULL;
+
+  dl->names = names;
+  dl->nnames = n;
+  dl->pool = pool;
+  return n;
+}
+
+/* Return a listing of the names in all the directories matching the
+   wildcarded directory name PATTERN that could match the filename being
+   completed.  If PREFIX is non-null, only names beginning with its first
+   PREFIX_LEN characters can match.  Returns NULL if nothing matches. */
+static DIR_LISTING *
+get_glob_listing (pattern, prefix, prefix_len)
+     const char *pattern, *prefix;
+     int prefix_len;
+{
+  glob_t g;
+  DIR_SCAN ds;
+  int flags, n;
+  size_t len;
+  register int i;
+
+  flags = GLOB_MARK;
+#if defined (GLOB_ONLYDIR)
+  flags |= GLOB_ONLYDIR;
 #endif
-      if ((_rl_to_lower (convfn[0]) == _rl_to_lower (filename[0])) &&
-	  (convlen >= filename_len) &&
-	  (_rl_strnicmp (filename, convfn, filename_len) == 0))
-	return 1;
+  if (glob (pattern, flags, (int (*) PARAMS((const char *, int)))NULL, &g) != 0)
+    {
+      globfree (&g);
+      return ((DIR_LISTING *)NULL);
     }
-  else
+
+  /* GLOB_MARK marks the directories with a trailing slash. */
+  ds.dirs = (char **)xmalloc ((g.gl_pathc + 1) * sizeof (char *));
+  for (i = ds.ndirs = 0; i < g.gl_pathc; i++)
     {
-      if ((convfn[0] == filename[0]) &&
-	  (convlen >= filename_len) &&
-	  (strncmp (filename, convfn, filename_len) == 0))
-	return 1;
+      len = strlen (g.gl_pathv[i]);
+      if (len && g.gl_pathv[i][len - 1] == '/')
+	ds.dirs[ds.ndirs++] = g.gl_pathv[i];
     }
-  return 0;
+
+  ds.listings = (DIR_LISTING *)xmalloc ((ds.ndirs + 1) * sizeof (DIR_LISTING));
+  memset (ds.listings, 0, (ds.ndirs + 1) * sizeof (DIR_LISTING));
+  ds.first = (int *)xmalloc ((ds.ndirs + 1) * sizeof (int));
+  ds.last = (int *)xmalloc ((ds.ndirs + 1) * sizeof (int));
+  ds.prefix = prefix;
+  ds.prefix_len = prefix_len;
+
+  scan_dirs (&ds);
+
+  free_dir_listing (&glob_listing);
+  n = merge_dir_listings (&glob_listing, &ds);
+  if (n)
+    glob_listing.path = savestring (pattern);
+
+  for (i = 0; i < ds.ndirs; i++)
+    free_dir_listing (&ds.listings[i]);
+  xfree (ds.listings);
+  xfree (ds.first);
+  xfree (ds.last);
+  xfree (ds.dirs);
+  globfree (&g);
+
+  return (n ? &glob_listing : (DIR_LISTING *)NULL);
 }
+#endif /* COMPLETION_GLOB */
 
 /* Okay, now we write the entry_function for filename completion.  In the
    general case.  Note that completion in the shell is a little different
@@ -2501,26 +5774,34 @@ rl_filename_completion_function (text, state)
      const char *text;
      int state;
 {
-  static DIR *directory = (DIR *)NULL;
+  static DIR_LISTING *listing = (DIR_LISTING *)NULL;
+  static int list_index, list_end;
+  static int *list_order;
+  static int range_matches;
+  static char **fuzzy_keys;
+  static unsigned long fuzzy_mask;
   static char *filename = (char *)NULL;
   static char *dirname = (char *)NULL;
   static char *users_dirname = (char *)NULL;
   static int filename_len;
-  char *temp, *dentry, *convfn;
-  int dirlen, dentlen, convlen;
-  int tilde_dirname;
-  struct dirent *entry;
+#if defined (MATCH_FILE_TYPES)
+  static int dirind = -1;
+  static int record_types;
+#endif
+  char *temp, *dentry, *convfn, *key;
+  int dirlen, dentlen, convlen, keylen, i;
+  int tilde_dirname, sorted_prefix, folded_prefix, fuzzy;
+  size_t keysize;
 
   /* If we don't have any state, then do some initialization. */
   if (state == 0)
     {
-      /* If we were interrupted before closing the directory or reading
-	 all of its contents, close it. */
-      if (directory)
-	{
-	  closedir (directory);
-	  directory = (DIR *)NULL;
-	}
+      COMPLETION_EXCLUSIVE ();
+
+      listing = (DIR_LISTING *)NULL;
+#if defined (COMPLETION_GLOB)
+      free_dir_listing (&glob_listing);
+#endif
       FREE (dirname);
       FREE (filename);
       FREE (users_dirname);
@@ -2597,7 +5878,11 @@ rl_filename_completion_function (text, state)
 	  xfree (dirname);
 	  dirname = savestring (users_dirname);
 	}
-      directory = opendir (dirname);
+      listing = get_dir_listing (dirname);
+#if defined (MATCH_FILE_TYPES)
+      record_types = on_completion_thread () || RL_ISSTATE (RL_STATE_COMPLETING);
+      dirind = (listing && record_types) ? add_match_dir (dirname) : -1;
+#endif
 
       /* Now dequote a non-null filename.  FILENAME will not be NULL, but may
 	 be empty. */
@@ -2610,22 +5895,102 @@ rl_filename_completion_function (text, state)
 	}
       filename_len = strlen (filename);
 
+      /* If the names in the listing are what we compare against and we're
+	 not ignoring case, the matches are all together in the sorted list
+	 and we can find them without looking at every name. */
+      sorted_prefix = filename_len && rl_filename_rewrite_hook == 0 && _rl_completion_case_fold == 0;
+
+      /* If we are ignoring case, the same is true of the names' folded
+	 keys, which are kept with the listing. */
+      folded_prefix = filename_len && rl_filename_rewrite_hook == 0 && _rl_completion_case_fold;
+
+      /* Fuzzy completion has to look at every name, but most of them can
+	 be rejected by checking a mask of the bytes they contain. */
+      fuzzy = filename_len && rl_filename_rewrite_hook == 0 && _rl_fuzzy_completion;
+      if (fuzzy)
+	sorted_prefix = folded_prefix = 0;
+
+#if defined (COMPLETION_GLOB)
+      /* If the directory name contains globbing characters, like
+	 /usr/man/man<WILD>/te<TAB>, read all the directories it matches
+	 and complete from the names in any of them.  A quoted word might
+	 have quoted the globbing characters, so we leave it alone. */
+      if (listing == 0 && rl_completion_found_quote == 0 && glob_chars_p (dirname))
+	listing = get_glob_listing (dirname, sorted_prefix ? filename : (char *)NULL, filename_len);
+#endif
+
+      list_index = 0;
+      list_end = listing ? listing->nnames : 0;
+      list_order = (int *)NULL;
+      range_matches = 0;
+      if (listing && sorted_prefix)
+	{
+	  list_index = dir_listing_lower_bound (listing, filename, filename_len);
+	  for (list_end = list_index;
+	       list_end < listing->nnames && strncmp (listing->names[list_end], filename, filename_len) == 0;
+	       list_end++)
+	    ;
+	}
+      else if (listing && folded_prefix)
+	{
+	  fold_dir_listing (listing, completion_fold_mode ());
+	  key = (char *)NULL;
+	  keysize = 0;
+	  keylen = fold_completion_name (filename, listing->fmode, &key, &keysize);
+	  list_index = folded_lower_bound (listing, key, keylen);
+	  for (list_end = list_index;
+	       list_end < listing->nnames && strncmp (listing->fkeys[listing->forder[list_end]], key, keylen) == 0;
+	       list_end++)
+	    ;
+	  xfree (key);
+	  list_order = listing->forder;
+	  range_matches = 1;
+	}
+
+      fuzzy_keys = (char **)NULL;
+      FREE (fuzzy_pattern);
+      fuzzy_pattern = (char *)NULL;
+      if (fuzzy)
+	{
+	  key = (char *)NULL;
+	  keysize = 0;
+	  if (_rl_completion_case_fold)
+	    {
+	      fuzzy_fold = completion_fold_mode ();
+	      fold_completion_name (filename, fuzzy_fold, &key, &keysize);
+	    }
+	  else
+	    {
+	      fuzzy_fold = FOLD_EXACT;
+	      key = savestring (filename);
+	    }
+	  fuzzy_pattern = key;
+	  fuzzy_mask = char_mask (key);
+	  _rl_completion_nonprefix = 1;
+	  if (listing)
+	    {
+	      if (fuzzy_fold != FOLD_EXACT)
+		fold_dir_listing (listing, fuzzy_fold);
+	      fuzzy_keys = (fuzzy_fold != FOLD_EXACT) ? listing->fkeys : listing->names;
+	      mask_dir_listing (listing, fuzzy_keys, fuzzy_fold);
+	    }
+	}
+
       rl_filename_completion_desired = 1;
     }
 
-  /* At this point we should entertain the possibility of hacking wildcarded
-     filenames, like /usr/man/man<WILD>/te<TAB>.  If the directory name
-     contains globbing characters, then build an array of directories, and
-     then map over that list while completing. */
-  /* *** UNIMPLEMENTED *** */
+  /* Now that we have some state, we can look through the directory. */
 
-  /* Now that we have some state, we can read the directory. */
-
-  entry = (struct dirent *)NULL;
-  while (directory && (entry = readdir (directory)))
+  dentry = (char *)NULL;
+  while (listing && list_index < list_end)
     {
-      convfn = dentry = entry->d_name;
-      convlen = dentlen = D_NAMLEN (entry);
+      i = list_order ? list_order[list_index] : list_index;
+      list_index++;
+      if (fuzzy_keys && ((listing->cmasks[i] & fuzzy_mask) != fuzzy_mask ||
+			 fuzzy_match_p (fuzzy_keys[i], fuzzy_pattern) == 0))
+	continue;
+      convfn = dentry = listing->names[i];
+      convlen = dentlen = strlen (dentry);
 
       if (rl_filename_rewrite_hook)
 	{
@@ -2639,26 +6004,35 @@ rl_filename_completion_function (text, state)
       if (filename_len == 0)
 	{
 	  if (_rl_match_hidden_files == 0 && HIDDEN_FILE (convfn))
-	    continue;
-
-	  if (convfn[0] != '.' ||
+	    ;
+	  else if (convfn[0] != '.' ||
 	       (convfn[1] && (convfn[1] != '.' || convfn[2])))
 	    break;
 	}
       else
 	{
-	  if (complete_fncmp (convfn, convlen, filename, filename_len))
+	  /* A fuzzy match only matches hidden files if the user typed the
+	     leading `.', like a prefix match does. */
+	  if (fuzzy_keys)
+	    {
+	      if (HIDDEN_FILE (convfn) == 0 || *filename == '.')
+		break;
+	    }
+	  else if (range_matches || complete_fncmp (convfn, convlen, filename, filename_len))
 	    break;
 	}
+
+      if (convfn != dentry)
+	xfree (convfn);
+      dentry = (char *)NULL;
     }
 
-  if (entry == 0)
+  if (dentry == 0)
     {
-      if (directory)
-	{
-	  closedir (directory);
-	  directory = (DIR *)NULL;
-	}
+      listing = (DIR_LISTING *)NULL;
+#if defined (COMPLETION_GLOB)
+      free_dir_listing (&glob_listing);
+#endif
       if (dirname)
 	{
 	  xfree (dirname);
@@ -2685,7 +6059,7 @@ rl_filename_completion_function (text, state)
 	  if (rl_complete_with_tilde_expansion && *users_dirname == '~')
 	    {
 	      dirlen = strlen (dirname);
-	      temp = (char *)xmalloc (2 + dirlen + D_NAMLEN (entry));
+	      temp = match_alloc (2 + dirlen + strlen (convfn));
 	      strcpy (temp, dirname);
 	      /* Canonicalization cuts off any final slash present.  We
 		 may need to add it back. */
@@ -2698,7 +6072,7 @@ rl_filename_completion_function (text, state)
 	  else
 	    {
 	      dirlen = strlen (users_dirname);
-	      temp = (char *)xmalloc (2 + dirlen + D_NAMLEN (entry));
+	      temp = match_alloc (2 + dirlen + strlen (convfn));
 	      strcpy (temp, users_dirname);
 	      /* Make sure that temp has a trailing slash here. */
 	      if (users_dirname[dirlen - 1] != '/')
@@ -2708,11 +6082,16 @@ rl_filename_completion_function (text, state)
 	  strcpy (temp + dirlen, convfn);
 	}
       else
-	temp = savestring (convfn);
+	temp = strcpy (match_alloc (strlen (convfn) + 1), convfn);
 
       if (convfn != dentry)
 	xfree (convfn);
 
+#if defined (MATCH_FILE_TYPES)
+      if (record_types)
+	record_match_file_type (temp, dentry, LISTING_NAME_TYPE (dentry), dirind);
+#endif
+
       return (temp);
     }
 }
@@ -2745,6 +6124,8 @@ rl_old_menu_complete (count, invoking_key)
      up to insert them. */
   if (rl_last_func != rl_old_menu_complete)
     {
+      COMPLETION_EXCLUSIVE ();
+
       /* Clean up from previous call, if any. */
       FREE (orig_text);
       if (matches)
@@ -2781,7 +6162,8 @@ rl_old_menu_complete (count, invoking_key)
 
       orig_text = rl_copy_text (orig_start, orig_end);
       matches = gen_completion_matches (orig_text, orig_start, orig_end,
-					our_func, found_quote, quote_char);
+					our_func, found_quote, quote_char,
+					rl_line_buffer);
 
       /* If we are matching filenames, the attempted completion function will
 	 have set rl_filename_completion_desired to a non-zero value.  The basic
@@ -2849,6 +6231,59 @@ rl_old_menu_complete (count, invoking_key)
   return (0);
 }
 
+/* Insert MATCH, the match menu completion remembers E for, like
+   insert_match, quoting it only the first time. */
+static void
+menu_insert_match (e, match, start, mtype, qc)
+     MENU_ENTRY *e;
+     char *match;
+     int start, mtype;
+     char *qc;
+{
+  int oqc;
+
+  if (e->quoted == 0 || e->iqc != *qc)
+    {
+      if (e->qfree)
+	xfree (e->quoted);
+      e->iqc = e->oqc = *qc;
+      e->quoted = make_quoted_replacement (match, mtype, &e->oqc);
+      e->qfree = e->quoted && e->quoted != match;
+    }
+
+  oqc = *qc;
+  *qc = e->oqc;
+  if (e->quoted)
+    insert_replacement (e->quoted, start, oqc, qc);
+}
+
+/* Append what follows MATCH, which menu completion remembers E for, like
+   append_to_match, looking at the file system only the first time.
+   ORIG_TEXT is the text being completed. */
+static void
+menu_append_to_match (e, match, orig_text, delimiter, quote_char)
+     MENU_ENTRY *e;
+     char *match, *orig_text;
+     int delimiter, quote_char;
+{
+  if (e->append == 0)
+    e->append = match_append_type (match, strcmp (orig_text, match));
+  append_type_to_match (e->append, delimiter, quote_char);
+}
+
+static void
+menu_free_entries (entries, n)
+     MENU_ENTRY *entries;
+     int n;
+{
+  int i;
+
+  for (i = 0; i < n; i++)
+    if (entries[i].qfree)
+      xfree (entries[i].quoted);
+  xfree (entries);
+}
+
 int
 rl_menu_complete (count, ignore)
      int count, ignore;
@@ -2865,13 +6300,19 @@ rl_menu_complete (count, ignore)
   static int orig_start, orig_end;
   static char quote_char;
   static int delimiter, cstate;
+  static MENU_ENTRY *entries = (MENU_ENTRY *)NULL;
 
   /* The first time through, we generate the list of matches and set things
      up to insert them. */
   if ((rl_last_func != rl_menu_complete && rl_last_func != rl_backward_menu_complete) || full_completion)
     {
+      COMPLETION_EXCLUSIVE ();
+
       /* Clean up from previous call, if any. */
       FREE (orig_text);
+      if (entries)
+	menu_free_entries (entries, match_list_size);
+      entries = (MENU_ENTRY *)NULL;
       if (matches)
 	_rl_free_match_list (matches);
 
@@ -2906,7 +6347,8 @@ rl_menu_complete (count, ignore)
 
       orig_text = rl_copy_text (orig_start, orig_end);
       matches = gen_completion_matches (orig_text, orig_start, orig_end,
-					our_func, found_quote, quote_char);
+					our_func, found_quote, quote_char,
+					rl_line_buffer);
 
       nontrivial_lcd = matches && strcmp (orig_text, matches[0]) != 0;
 
@@ -2942,6 +6384,11 @@ rl_menu_complete (count, ignore)
 	  return (0);
         }
 
+      /* Remember how each match is quoted and what follows it as we
+	 cycle through them. */
+      entries = (MENU_ENTRY *)xmalloc (match_list_size * sizeof (MENU_ENTRY));
+      memset (entries, 0, match_list_size * sizeof (MENU_ENTRY));
+
       /* matches[0] is lcd if match_list_size > 1, but the circular buffer
 	 code below should take care of it. */
       if (*matches[0])
@@ -2957,7 +6404,7 @@ rl_menu_complete (count, ignore)
 	  /* If there are so many matches that the user has to be asked
 	     whether or not he wants to see the matches, menu completion
 	     is unwieldy. */
-	  if (rl_completion_query_items > 0 && match_list_size >= rl_completion_query_items)
+	  if (rl_completion_query_items > 0 && match_list_size + rl_completion_matches_omitted >= rl_completion_query_items)
 	    {
 	      rl_ding ();
 	      FREE (matches);
@@ -3009,13 +6456,14 @@ rl_menu_complete (count, ignore)
   if (match_list_index == 0 && match_list_size > 1)
     {
       rl_ding ();
-      insert_match (matches[0], orig_start, MULT_MATCH, &quote_char);
+      menu_insert_match (entries, matches[0], orig_start, MULT_MATCH, &quote_char);
     }
   else
     {
-      insert_match (matches[match_list_index], orig_start, SINGLE_MATCH, &quote_char);
-      append_to_match (matches[match_list_index], delimiter, quote_char,
-		       strcmp (orig_text, matches[match_list_index]));
+      menu_insert_match (entries + match_list_index, matches[match_list_index],
+			 orig_start, SINGLE_MATCH, &quote_char);
+      menu_append_to_match (entries + match_list_index, matches[match_list_index],
+			    orig_text, delimiter, quote_char);
     }
 
   completion_changed_buffer = 1;
@@ -71,6 +71,17 @@ extern char *strchr ();
 /* Possible definitions for history starting point specification. */
 #define ANCHORED_SEARCH 1
 #define NON_ANCHORED_SEARCH 0
+#define REGEX_SEARCH 2
+
+/* Regular expression history searching requires POSIX regcomp/regexec. */
+#if defined (HAVE_REGEX_H) && defined (HAVE_REGCOMP) && defined (HAVE_REGEXEC)
+#  define HISTORY_REGEX_SEARCH
+#endif
+
+/* Searching long history lists in parallel requires POSIX threads. */
+#if defined (HAVE_PTHREAD_H) && defined (HAVE_PTHREAD_CREATE)
+#  define HISTORY_PARALLEL_SEARCH
+#endif
 
 /* Possible definitions for what style of writing the history file we want. */
 #define HISTORY_APPEND 0
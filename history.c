@@ -62,8 +62,24 @@ extern int errno;
 /* The number of slots to increase the_history by. */
 #define DEFAULT_HISTORY_GROW_SIZE 50
 
+/* Information the library keeps about each history entry, in an array
+   parallel to the_history. */
+typedef struct _hist_meta {
+  histid_t id;		/* stable identifier; increases with the index */
+  time_t time;		/* the entry's timestamp, already parsed */
+  time_t maxtime;	/* latest timestamp of this and all earlier entries */
+  size_t bytes;		/* bytes counted toward history_bytes */
+} HIST_META;
+
 static char *hist_inittime PARAMS((void));
 
+static void hist_meta_alloc PARAMS((int));
+static void hist_meta_remove PARAMS((int, int));
+static void hist_update_maxtime PARAMS((void));
+static size_t hist_entry_bytes PARAMS((HIST_ENTRY *));
+static void hist_enforce_byte_budget PARAMS((void));
+static int hist_maxtime_search PARAMS((time_t, int));
+
 /* **************************************************************** */
 /*								    */
 /*			History Functions			    */
@@ -80,6 +96,26 @@ static int history_stifled;
 /* The current number of slots allocated to the input_history. */
 static int history_size;
 
+/* Per-entry information, with HISTORY_SIZE slots.  Only the first
+   HISTORY_MAXTIME_VALID entries have an up-to-date maxtime member; the
+   rest are brought up to date when the time index is next used. */
+static HIST_META *history_meta = (HIST_META *)NULL;
+static int history_maxtime_valid;
+
+/* The identifier given to the most recently added history entry.
+   Identifiers are never reused. */
+static histid_t history_last_id;
+
+/* The number of bytes used by the lines and timestamps of the entries in
+   the history list, kept up to date as entries are added, removed, and
+   changed. */
+static size_t history_bytes;
+
+/* Non-zero means that we have enforced a limit on the number of bytes
+   the history list may use; HISTORY_MAX_BYTES is that limit. */
+static int history_bytes_stifled;
+static int history_max_bytes;
+
 /* If HISTORY_STIFLED is non-zero, then this is the maximum number of
    entries to remember. */
 int history_max_entries;
@@ -118,12 +154,71 @@ void
 history_set_history_state (state)
      HISTORY_STATE *state;
 {
+  register int i;
+  int same;
+
+  /* Entries keep their identifiers if the caller is restoring the list
+     it got from history_get_history_state() without adding or removing
+     anything. */
+  same = state->entries == the_history && state->length == history_length;
+
   the_history = state->entries;
   history_offset = state->offset;
   history_length = state->length;
   history_size = state->size;
   if (state->flags & HS_STIFLED)
     history_stifled = 1;
+
+  /* We don't know what has happened to these entries, so rebuild the
+     rest of the per-entry information from scratch. */
+  hist_meta_alloc ((history_size > history_length) ? history_size : history_length + 1);
+  history_bytes = 0;
+  for (i = 0; i < history_length; i++)
+    {
+      if (same == 0)
+	history_meta[i].id = ++history_last_id;
+      history_meta[i].time = history_get_time (the_history[i]);
+      history_bytes += history_meta[i].bytes = hist_entry_bytes (the_history[i]);
+    }
+  history_maxtime_valid = 0;
+}
+
+/* Make sure there are SIZE slots in the per-entry information array. */
+static void
+hist_meta_alloc (size)
+     int size;
+{
+  history_meta = (HIST_META *)xrealloc (history_meta, (size > 0 ? size : 1) * sizeof (HIST_META));
+}
+
+/* Remove COUNT slots from the per-entry information array starting at
+   WHICH, keeping it parallel to the_history.  Call this before
+   history_length is updated. */
+static void
+hist_meta_remove (which, count)
+     int which, count;
+{
+  int i, keep;
+
+  for (i = which; i < which + count; i++)
+    history_bytes -= history_meta[i].bytes;
+
+  /* Removing a single entry doesn't change the running maximum of the
+     ones that remain unless it was later than everything before it (or,
+     if it was the first entry, later than its successor). */
+  if (which < history_maxtime_valid)
+    {
+      if (count == 1 && which > 0)
+	keep = history_meta[which].time <= history_meta[which - 1].maxtime;
+      else if (count == 1 && history_length > 1)
+	keep = history_meta[0].time <= history_meta[1].time;
+      else
+	keep = 0;
+      history_maxtime_valid = keep ? history_maxtime_valid - 1 : which;
+    }
+
+  memmove (history_meta + which, history_meta + which + count,
+	   (history_length - which - count) * sizeof (HIST_META));
 }
 
 /* Begin a session in which the history functions might be used.  This
@@ -135,17 +230,21 @@ using_history ()
 }
 
 /* Return the number of bytes that the primary history entries are using.
-   This just adds up the lengths of the_history->lines and the associated
-   timestamps. */
+   This is the sum of the lengths of the_history->lines and the associated
+   timestamps, which we keep as entries are added and removed. */
 int
 history_total_bytes ()
 {
-  register int i, result;
-
-  for (i = result = 0; the_history && the_history[i]; i++)
-    result += HISTENT_BYTES (the_history[i]);
+  return ((int)history_bytes);
+}
 
-  return (result);
+/* Return the number of bytes HS counts toward history_bytes. */
+static size_t
+hist_entry_bytes (hs)
+     HIST_ENTRY *hs;
+{
+  return ((hs->line ? strlen (hs->line) : 0) +
+	  (hs->timestamp ? strlen (hs->timestamp) : 0));
 }
 
 /* Returns the magic number which says what history element we are
@@ -219,6 +318,59 @@ history_get (offset)
 		: the_history[local_index];
 }
 
+/* Return the identifier of the history entry at absolute index WHICH, or
+   0 if there is no such entry.  An entry's identifier doesn't change when
+   other entries are added or removed, or when it is replaced with
+   replace_history_entry(). */
+histid_t
+history_get_id (which)
+     int which;
+{
+  return (which < 0 || which >= history_length || the_history == 0)
+		? (histid_t)0
+		: history_meta[which].id;
+}
+
+/* Return the absolute index of the history entry with identifier ID, or
+   -1 if that entry is no longer in the history list.  Identifiers are
+   assigned in increasing order and entries are never reordered, so this
+   is a binary search. */
+int
+history_id_index (id)
+     histid_t id;
+{
+  int lo, hi, mid;
+
+  if (id == 0 || the_history == 0)
+    return -1;
+
+  lo = 0;
+  hi = history_length - 1;
+  while (lo <= hi)
+    {
+      mid = lo + (hi - lo) / 2;
+      if (history_meta[mid].id == id)
+	return mid;
+      else if (history_meta[mid].id < id)
+	lo = mid + 1;
+      else
+	hi = mid - 1;
+    }
+  return -1;
+}
+
+/* Return the history entry with identifier ID, or NULL if it is no longer
+   in the history list. */
+HIST_ENTRY *
+history_get_by_id (id)
+     histid_t id;
+{
+  int i;
+
+  i = history_id_index (id);
+  return ((i >= 0) ? the_history[i] : (HIST_ENTRY *)NULL);
+}
+
 HIST_ENTRY *
 alloc_history_entry (string, ts)
      char *string;
@@ -293,6 +445,7 @@ add_history (string)
       /* If there is something in the slot, then remove it. */
       if (the_history[0])
 	(void) free_history_entry (the_history[0]);
+      hist_meta_remove (0, 1);
 
       /* Copy the rest of the entries, moving down one slot.  Copy includes
 	 trailing NULL.  */
@@ -312,6 +465,8 @@ add_history (string)
 	  else
 	    history_size = DEFAULT_HISTORY_INITIAL_SIZE;
 	  the_history = (HIST_ENTRY **)xmalloc (history_size * sizeof (HIST_ENTRY *));
+	  hist_meta_alloc (history_size);
+	  history_maxtime_valid = 0;
 	  new_length = 1;
 	}
       else
@@ -321,6 +476,7 @@ add_history (string)
 	      history_size += DEFAULT_HISTORY_GROW_SIZE;
 	      the_history = (HIST_ENTRY **)
 		xrealloc (the_history, history_size * sizeof (HIST_ENTRY *));
+	      hist_meta_alloc (history_size);
 	    }
 	  new_length = history_length + 1;
 	}
@@ -330,7 +486,12 @@ add_history (string)
 
   the_history[new_length] = (HIST_ENTRY *)NULL;
   the_history[new_length - 1] = temp;
+  history_meta[new_length - 1].id = ++history_last_id;
+  history_meta[new_length - 1].time = history_get_time (temp);
+  history_bytes += history_meta[new_length - 1].bytes = hist_entry_bytes (temp);
   history_length = new_length;
+
+  hist_enforce_byte_budget ();
 }
 
 /* Change the time stamp of the most recent history entry to STRING. */
@@ -345,6 +506,12 @@ add_history_time (string)
   hs = the_history[history_length - 1];
   FREE (hs->timestamp);
   hs->timestamp = savestring (string);
+
+  history_meta[history_length - 1].time = history_get_time (hs);
+  history_bytes -= history_meta[history_length - 1].bytes;
+  history_bytes += history_meta[history_length - 1].bytes = hist_entry_bytes (hs);
+  if (history_maxtime_valid >= history_length)
+    history_maxtime_valid = history_length - 1;
 }
 
 /* Free HIST and return the data so the calling application can free it
@@ -406,6 +573,9 @@ replace_history_entry (which, line, data)
   temp->timestamp = savestring (old_value->timestamp);
   the_history[which] = temp;
 
+  history_bytes -= history_meta[which].bytes;
+  history_bytes += history_meta[which].bytes = hist_entry_bytes (temp);
+
   return (old_value);
 }
 
@@ -430,6 +600,9 @@ _hs_append_history_line (which, line)
       hent->line = newline;
       hent->line[curlen++] = '\n';
       strcpy (hent->line + curlen, line);
+
+      history_bytes += newlen - curlen;
+      history_meta[which].bytes += newlen - curlen;
     }
 }
 
@@ -495,6 +668,7 @@ remove_history (which)
 
   for (i = which; i < history_length; i++)
     the_history[i] = the_history[i + 1];
+  hist_meta_remove (which, 1);
 
   history_length--;
 
@@ -516,6 +690,7 @@ stifle_history (max)
       /* This loses because we cannot free the data. */
       for (i = 0, j = history_length - max; i < j; i++)
 	free_history_entry (the_history[i]);
+      hist_meta_remove (0, j);
 
       history_base = i;
       for (j = 0, i = history_length - max; j < max; i++, j++)
@@ -549,6 +724,68 @@ history_is_stifled ()
   return (history_stifled);
 }
 
+/* If the history list is using more than history_max_bytes, remove the
+   oldest entries until it isn't.  This may remove every entry, including
+   one just added, if a single entry is larger than the limit.  Only
+   add_history and stifle_history_bytes call this; the functions that
+   change an entry in place leave the list alone, since their callers
+   are holding offsets into it. */
+static void
+hist_enforce_byte_budget ()
+{
+  register int i, j;
+  size_t bytes;
+
+  if (history_bytes_stifled == 0 || history_bytes <= (size_t)history_max_bytes)
+    return;
+
+  for (j = 0, bytes = history_bytes; j < history_length && bytes > (size_t)history_max_bytes; j++)
+    bytes -= history_meta[j].bytes;
+  if (j == 0)
+    return;
+
+  /* This loses because we cannot free the data. */
+  for (i = 0; i < j; i++)
+    free_history_entry (the_history[i]);
+  hist_meta_remove (0, j);
+
+  /* Copy includes trailing NULL. */
+  memmove (the_history, the_history + j, (history_length - j + 1) * sizeof (HIST_ENTRY *));
+  history_length -= j;
+  history_base += j;
+  if (history_offset > history_length)
+    history_offset = history_length;
+}
+
+/* Stifle the history list, remembering only as many of the most recent
+   entries as fit in MAX bytes of lines and timestamps. */
+void
+stifle_history_bytes (max)
+     int max;
+{
+  if (max < 0)
+    max = 0;
+
+  history_bytes_stifled = 1;
+  history_max_bytes = max;
+  hist_enforce_byte_budget ();
+}
+
+/* Stop limiting the number of bytes the history list may use.  This
+   returns the previous limit.  The value is positive if the history was
+   limited, negative if it wasn't. */
+int
+unstifle_history_bytes ()
+{
+  if (history_bytes_stifled)
+    {
+      history_bytes_stifled = 0;
+      return (history_max_bytes);
+    }
+  else
+    return (-history_max_bytes);
+}
+
 void
 clear_history ()
 {
@@ -562,4 +799,104 @@ clear_history ()
     }
 
   history_offset = history_length = 0;
+  history_maxtime_valid = 0;
+  history_bytes = 0;
+}
+
+/* **************************************************************** */
+/*								    */
+/*			History Time Index			    */
+/*								    */
+/* **************************************************************** */
+
+/* Bring the running maximum of the entry timestamps up to date for the
+   whole history list.  Entries are usually added in time order, but
+   timestamps read from a history file or set with add_history_time need
+   not be, and the running maximum is non-decreasing regardless. */
+static void
+hist_update_maxtime ()
+{
+  register int i;
+  time_t m;
+
+  i = history_maxtime_valid;
+  m = (i > 0) ? history_meta[i - 1].maxtime : 0;
+  for ( ; i < history_length; i++)
+    {
+      if (i == 0 || history_meta[i].time > m)
+	m = history_meta[i].time;
+      history_meta[i].maxtime = m;
+    }
+  history_maxtime_valid = history_length;
+}
+
+/* Return the index of the first entry whose timestamp is greater than T,
+   or at least T if INCLUSIVE is non-zero, or history_length if there is no
+   such entry.  The running maximum first exceeds T at exactly that entry,
+   so a binary search over it gives the right answer even if the
+   timestamps are out of order. */
+static int
+hist_maxtime_search (t, inclusive)
+     time_t t;
+     int inclusive;
+{
+  int lo, hi, mid;
+
+  hist_update_maxtime ();
+  lo = 0;
+  hi = history_length;
+  while (lo < hi)
+    {
+      mid = lo + (hi - lo) / 2;
+      if (inclusive ? (history_meta[mid].maxtime >= t) : (history_meta[mid].maxtime > t))
+	hi = mid;
+      else
+	lo = mid + 1;
+    }
+  return lo;
+}
+
+/* Return the absolute index of the first history entry with a timestamp
+   at or after T, or -1 if there is no such entry. */
+int
+history_search_time (t)
+     time_t t;
+{
+  int i;
+
+  if (history_length == 0 || the_history == 0)
+    return -1;
+  i = hist_maxtime_search (t, 1);
+  return ((i < history_length) ? i : -1);
+}
+
+/* Find the history entries with timestamps between START and END,
+   inclusive.  *STARTP is set to the absolute index of the first entry at
+   or after START, and *ENDP to the index of the first entry after END or
+   history_length, so the entries are the_history[*STARTP] up to but not
+   including the_history[*ENDP].  Returns the number of entries in the
+   range.  If the timestamps are out of order, the range may include
+   entries earlier than START that were added after entries within it. */
+int
+history_time_range (start, end, startp, endp)
+     time_t start, end;
+     int *startp, *endp;
+{
+  int s, e;
+
+  if (history_length == 0 || the_history == 0 || start > end)
+    s = e = 0;
+  else
+    {
+      s = hist_maxtime_search (start, 1);
+      e = hist_maxtime_search (end, 0);
+      if (e < s)
+	e = s;
+    }
+
+  if (startp)
+    *startp = s;
+  if (endp)
+    *endp = e;
+  return (e - s);
 }
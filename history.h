@@ -49,6 +49,10 @@ typedef struct _hist_entry {
   histdata_t data;
 } HIST_ENTRY;
 
+/* A stable identifier for a history entry.  Identifiers are never reused,
+   and zero is never a valid identifier. */
+typedef unsigned long long histid_t;
+
 /* Size of the history-library-managed space in history entry HS. */
 #define HISTENT_BYTES(hs)	(strlen ((hs)->line) + strlen ((hs)->timestamp))
 
@@ -121,6 +125,16 @@ extern int unstifle_history PARAMS((void));
 /* Return 1 if the history is stifled, 0 if it is not. */
 extern int history_is_stifled PARAMS((void));
 
+/* Stifle the history list, remembering only as many of the most recent
+   entries as fit in MAX bytes.  The limit is applied when entries are
+   added, not when existing ones grow. */
+extern void stifle_history_bytes PARAMS((int));
+
+/* Stop limiting the number of bytes used by the history list.  This
+   returns the previous limit.  The value is positive if the history was
+   limited, negative if it wasn't. */
+extern int unstifle_history_bytes PARAMS((void));
+
 /* Information about the history list. */
 
 /* Return a NULL terminated array of HIST_ENTRY which is the current input
@@ -140,12 +154,34 @@ extern HIST_ENTRY *current_history PARAMS((void));
    array.  OFFSET is relative to history_base. */
 extern HIST_ENTRY *history_get PARAMS((int));
 
+/* Return the stable identifier of the history entry at absolute index
+   WHICH, or 0 if there is no such entry. */
+extern histid_t history_get_id PARAMS((int));
+
+/* Return the absolute index of the history entry with identifier ID, or
+   -1 if it is no longer in the history list. */
+extern int history_id_index PARAMS((histid_t));
+
+/* Return the history entry with identifier ID, or NULL if it is no longer
+   in the history list. */
+extern HIST_ENTRY *history_get_by_id PARAMS((histid_t));
+
 /* Return the timestamp associated with the HIST_ENTRY * passed as an
    argument */
 extern time_t history_get_time PARAMS((HIST_ENTRY *));
 
-/* Return the number of bytes that the primary history entries are using.
-   This just adds up the lengths of the_history->lines. */
+/* Return the absolute index of the first history entry with a timestamp
+   at or after the time passed as an argument, or -1 if there is none. */
+extern int history_search_time PARAMS((time_t));
+
+/* Find the history entries with timestamps between START and END,
+   inclusive.  The range is returned as absolute indices in *STARTP
+   (first entry) and *ENDP (one past the last entry).  Returns the number
+   of entries in the range. */
+extern int history_time_range PARAMS((time_t, time_t, int *, int *));
+
+/* Return the number of bytes that the primary history entries are using:
+   the lengths of the_history->lines and their timestamps. */
 extern int history_total_bytes PARAMS((void));
 
 /* Moving around the history list. */
@@ -185,6 +221,12 @@ extern int history_search_prefix PARAMS((const char *, int));
    was found, or -1 otherwise. */
 extern int history_search_pos PARAMS((const char *, int, int));
 
+/* Search the history for a line matching PATTERN, a POSIX extended
+   regular expression, starting at history_offset.  DIRECTION is as in
+   history_search().  Returns the offset in the matching line where the
+   match begins, or -1 if there is no match or PATTERN is invalid. */
+extern int history_search_regex PARAMS((const char *, int));
+
 /* Managing the history file. */
 
 /* Add the contents of FILENAME to the history list, a line at a time.
@@ -263,6 +305,8 @@ extern int history_quotes_inhibit_expansion;
 
 extern int history_write_timestamps;
 
+extern int history_search_threads;
+
 /* These two are undocumented; the second is reserved for future use */
 extern int history_multiline_entries;
 extern int history_file_version;
@@ -26,6 +26,7 @@
 #endif
 
 #include <stdio.h>
+#include <ctype.h>
 #if defined (HAVE_STDLIB_H)
 #  include <stdlib.h>
 #else
@@ -41,18 +42,453 @@
 
 #include "history.h"
 #include "histlib.h"
+#include "xmalloc.h"
+
+#if defined (HISTORY_REGEX_SEARCH)
+#  include <regex.h>
+#endif
+
+#if defined (HISTORY_PARALLEL_SEARCH)
+#  include <pthread.h>
+#  include <signal.h>
+#endif
 
 /* The list of alternate characters that can delimit a history search
    string. */
 char *history_search_delimiter_chars = (char *)NULL;
 
+/* If greater than 1, long searches are divided among this many threads. */
+int history_search_threads = 0;
+
+typedef struct _hist_regex HIST_REGEX;
+
+static int history_search_line PARAMS((const char *, const char *, int, int, int, HIST_REGEX *));
 static int history_search_internal PARAMS((const char *, int, int));
 
+#if defined (HISTORY_REGEX_SEARCH)
+/* A small cache of compiled regular expressions, so that repeating a
+   search (or searching again in the other direction) doesn't recompile
+   the pattern.  When the cache is full, the least-recently-used entry is
+   replaced. */
+#define REGEX_CACHE_SIZE	8
+
+struct _hist_regex {
+  char *pattern;		/* source pattern; NULL if the slot is free */
+  regex_t re;
+  char *literal;		/* a string every match must contain */
+  size_t litlen;
+  unsigned long lastuse;
+};
+
+static HIST_REGEX regex_cache[REGEX_CACHE_SIZE];
+static unsigned long regex_cache_clock;
+
+static char *regex_required_literal PARAMS((const char *, size_t *));
+static HIST_REGEX *regex_cache_lookup PARAMS((const char *));
+
+#if defined (HAVE_MEMMEM)
+#  define FIND_LITERAL(line, llen, lit, litlen) \
+	(memmem ((line), (llen), (lit), (litlen)) != 0)
+#else
+#  define FIND_LITERAL(line, llen, lit, litlen) \
+	(strstr ((line), (lit)) != 0)
+#endif
+
+/* Return the longest run of literal characters that must appear in any
+   string matched by the POSIX extended regular expression PATTERN, and
+   set *LENP to its length.  This is deliberately conservative: anything
+   inside a group, a bracket expression, an escape we don't understand, or
+   a character made optional by a following `*', `?', or `{' ends the
+   current run, and a pattern with alternation has no required literal.
+   Returns NULL if there is no usable literal. */
+static char *
+regex_required_literal (pattern, lenp)
+     const char *pattern;
+     size_t *lenp;
+{
+  const char *p;
+  char *cur, *best;
+  size_t curlen, bestlen;
+  int depth, c, next;
+
+#define END_RUN() \
+  do { \
+    if (curlen > bestlen) \
+      { \
+	memcpy (best, cur, curlen); \
+	bestlen = curlen; \
+      } \
+    curlen = 0; \
+  } while (0)
+
+  *lenp = 0;
+  cur = (char *)xmalloc (strlen (pattern) + 1);
+  best = (char *)xmalloc (strlen (pattern) + 1);
+  curlen = bestlen = 0;
+  depth = 0;
+
+  for (p = pattern; *p; p++)
+    {
+      c = (unsigned char)*p;
+      if (c == '|')
+	{
+	  curlen = bestlen = 0;
+	  break;
+	}
+      else if (c == '[')
+	{
+	  /* Skip the bracket expression, including a leading `]' or `^]'
+	     and any embedded [:class:], [=equiv=], or [.coll.] */
+	  END_RUN ();
+	  p++;
+	  if (*p == '^')
+	    p++;
+	  if (*p == ']')
+	    p++;
+	  while (*p && *p != ']')
+	    {
+	      if (*p == '[' && (p[1] == ':' || p[1] == '=' || p[1] == '.'))
+		{
+		  next = p[1];
+		  for (p += 2; *p && (*p != next || p[1] != ']'); p++)
+		    ;
+		  if (*p)
+		    p++;
+		}
+	      if (*p)
+		p++;
+	    }
+	  if (*p == 0)
+	    break;
+	  continue;
+	}
+      else if (c == '(')
+	{
+	  END_RUN ();
+	  depth++;
+	  continue;
+	}
+      else if (c == ')')
+	{
+	  END_RUN ();
+	  if (depth > 0)
+	    depth--;
+	  continue;
+	}
+      else if (depth > 0)
+	{
+	  /* Skip escaped characters inside groups so an escaped `|' or
+	     `)' doesn't confuse us. */
+	  if (c == '\\' && p[1])
+	    p++;
+	  continue;
+	}
+      else if (c == '\\')
+	{
+	  /* Escaped alphanumerics are back-references or GNU extensions
+	     like \w and \b; only escaped punctuation is a literal. */
+	  c = (unsigned char)p[1];
+	  if (c == 0)
+	    break;
+	  p++;
+	  if (isalnum (c) || c >= 0x80)
+	    {
+	      END_RUN ();
+	      continue;
+	    }
+	}
+      else if (c >= 0x80 || strchr (".^$*+?{}", c))
+	{
+	  /* Don't try to reason about quantifiers applied to multibyte
+	     characters. */
+	  END_RUN ();
+	  continue;
+	}
+
+      /* C is a literal character; see whether a quantifier follows it. */
+      next = p[1];
+      if (next == '*' || next == '?' || next == '{')
+	{
+	  END_RUN ();
+	  continue;
+	}
+      cur[curlen++] = c;
+      if (next == '+')
+	END_RUN ();
+    }
+  END_RUN ();
+#undef END_RUN
+
+  xfree (cur);
+  if (bestlen == 0)
+    {
+      xfree (best);
+      return ((char *)NULL);
+    }
+  best[bestlen] = '\0';
+  *lenp = bestlen;
+  return (best);
+}
+
+/* Return the cache entry for PATTERN, compiling it if necessary.  Returns
+   NULL if PATTERN is not a valid extended regular expression. */
+static HIST_REGEX *
+regex_cache_lookup (pattern)
+     const char *pattern;
+{
+  register int i;
+  HIST_REGEX *ent;
+
+  ent = (HIST_REGEX *)NULL;
+  for (i = 0; i < REGEX_CACHE_SIZE; i++)
+    {
+      if (regex_cache[i].pattern && STREQ (regex_cache[i].pattern, pattern))
+	{
+	  regex_cache[i].lastuse = ++regex_cache_clock;
+	  return (&regex_cache[i]);
+	}
+      if (ent == 0 || (ent->pattern && (regex_cache[i].pattern == 0 || regex_cache[i].lastuse < ent->lastuse)))
+	ent = &regex_cache[i];
+    }
+
+  /* ENT is now either a free slot or the least-recently-used entry. */
+  if (ent->pattern)
+    {
+      regfree (&ent->re);
+      xfree (ent->pattern);
+      FREE (ent->literal);
+      ent->pattern = ent->literal = (char *)NULL;
+    }
+
+  if (regcomp (&ent->re, pattern, REG_EXTENDED) != 0)
+    return ((HIST_REGEX *)NULL);
+
+  ent->pattern = savestring (pattern);
+  ent->literal = regex_required_literal (pattern, &ent->litlen);
+  ent->lastuse = ++regex_cache_clock;
+
+  return (ent);
+}
+#endif /* HISTORY_REGEX_SEARCH */
+
+/* Return the offset in LINE at which STRING, of length STRING_LEN,
+   matches, or -1 if it doesn't match.  ANCHORED is as for
+   history_search_internal.  If REVERSE is non-zero, an unanchored search
+   returns the last occurrence of STRING in LINE rather than the first.
+   HRE is the compiled form of STRING for regular expression searches.
+   This doesn't touch any global state, so the parallel search code can
+   call it from several threads at once. */
+static int
+history_search_line (line, string, string_len, anchored, reverse, hre)
+     const char *line;
+     const char *string;
+     int string_len, anchored, reverse;
+     HIST_REGEX *hre;
+{
+  register int line_index, limit;
+#if defined (HISTORY_REGEX_SEARCH)
+  regmatch_t match;
+#endif
+
+  line_index = strlen (line);
+
+  /* Regular expression searches skip lines that don't contain the
+     pattern's required literal before running the matcher. */
+  if (anchored == REGEX_SEARCH)
+    {
+#if defined (HISTORY_REGEX_SEARCH)
+      if ((hre->litlen == 0 ||
+	    (hre->litlen <= line_index && FIND_LITERAL (line, line_index, hre->literal, hre->litlen))) &&
+	  regexec (&hre->re, line, 1, &match, 0) == 0)
+	return (match.rm_so);
+#endif
+      return (-1);
+    }
+
+  /* If STRING is longer than line, no match. */
+  if (string_len > line_index)
+    return (-1);
+
+  /* Handle anchored searches first. */
+  if (anchored == ANCHORED_SEARCH)
+    return (STREQN (string, line, string_len) ? 0 : -1);
+
+  /* Do substring search. */
+  if (reverse)
+    {
+      for (line_index -= string_len; line_index >= 0; line_index--)
+	if (STREQN (string, line + line_index, string_len))
+	  return (line_index);
+    }
+  else
+    {
+      limit = line_index - string_len + 1;
+      for (line_index = 0; line_index < limit; line_index++)
+	if (STREQN (string, line + line_index, string_len))
+	  return (line_index);
+    }
+
+  return (-1);
+}
+
+#if defined (HISTORY_PARALLEL_SEARCH)
+/* State shared by the threads taking part in one parallel search.  The
+   lines to be searched are numbered 0..NLINES-1 by distance from START in
+   the search direction and divided into chunks of PARALLEL_CHUNK_SIZE
+   lines.  Threads claim chunks in order, nearest first; when a thread
+   finds a match it records the chunk number, and nobody bothers with
+   chunks farther away than that.  The match in the lowest-numbered chunk
+   is the nearest one, so the result is the same as a serial search. */
+typedef struct _hist_psearch {
+  HIST_ENTRY **list;
+  const char *string;
+  int string_len;
+  int anchored;
+  int reverse;
+  HIST_REGEX *hre;
+
+  int start;
+  int nlines;
+  int nchunks;
+
+  pthread_mutex_t lock;		/* protects everything below */
+  int next_chunk;
+  int found_chunk;		/* NCHUNKS until a match is found */
+  int found_index;
+  int found_offset;
+} HIST_PSEARCH;
+
+/* Don't start threads unless there are at least this many lines to
+   search, and hand them out this many at a time. */
+#define PARALLEL_SEARCH_MIN	65536
+#define PARALLEL_CHUNK_SIZE	8192
+
+/* How often a thread checks whether a nearer match has made the rest of
+   its chunk irrelevant.  Must be a power of two. */
+#define PARALLEL_CHECK_INTERVAL	1024
+
+#define MAX_SEARCH_THREADS	64
+
+static int history_search_parallel PARAMS((HIST_PSEARCH *, int));
+static void *psearch_worker PARAMS((void *));
+static void *psearch_thread PARAMS((void *));
+
+/* Claim and search chunks from PS until there are none left that could
+   contain a match nearer than one already found. */
+static void *
+psearch_worker (arg)
+     void *arg;
+{
+  HIST_PSEARCH *ps;
+  int chunk, n, end, i, off, stop;
+
+  ps = (HIST_PSEARCH *)arg;
+  for (;;)
+    {
+      pthread_mutex_lock (&ps->lock);
+      chunk = ps->next_chunk;
+      if (chunk >= ps->nchunks || chunk > ps->found_chunk)
+	{
+	  pthread_mutex_unlock (&ps->lock);
+	  break;
+	}
+      ps->next_chunk++;
+      pthread_mutex_unlock (&ps->lock);
+
+      n = chunk * PARALLEL_CHUNK_SIZE;
+      end = n + PARALLEL_CHUNK_SIZE;
+      if (end > ps->nlines)
+	end = ps->nlines;
+
+      for ( ; n < end; n++)
+	{
+	  if ((n & (PARALLEL_CHECK_INTERVAL - 1)) == 0)
+	    {
+	      pthread_mutex_lock (&ps->lock);
+	      stop = ps->found_chunk < chunk;
+	      pthread_mutex_unlock (&ps->lock);
+	      if (stop)
+		break;
+	    }
+
+	  i = ps->reverse ? ps->start - n : ps->start + n;
+	  off = history_search_line (ps->list[i]->line, ps->string, ps->string_len,
+				     ps->anchored, ps->reverse, ps->hre);
+	  if (off >= 0)
+	    {
+	      pthread_mutex_lock (&ps->lock);
+	      if (chunk < ps->found_chunk)
+		{
+		  ps->found_chunk = chunk;
+		  ps->found_index = i;
+		  ps->found_offset = off;
+		}
+	      pthread_mutex_unlock (&ps->lock);
+	      break;
+	    }
+	}
+    }
+
+  return ((void *)NULL);
+}
+
+/* Thread start routine.  Signals are blocked in the helper threads so
+   they are always handled by the application's thread. */
+static void *
+psearch_thread (arg)
+     void *arg;
+{
+  sigset_t set;
+
+  sigfillset (&set);
+  pthread_sigmask (SIG_BLOCK, &set, (sigset_t *)NULL);
+  return (psearch_worker (arg));
+}
+
+/* Search the lines described by PS using NTHREADS threads, counting the
+   calling thread.  Returns the index of the nearest matching line and
+   leaves the offset of the match in PS->found_offset, or returns -1. */
+static int
+history_search_parallel (ps, nthreads)
+     HIST_PSEARCH *ps;
+     int nthreads;
+{
+  pthread_t tids[MAX_SEARCH_THREADS];
+  int i, nstarted;
+
+  ps->nchunks = (ps->nlines + PARALLEL_CHUNK_SIZE - 1) / PARALLEL_CHUNK_SIZE;
+  ps->next_chunk = 0;
+  ps->found_chunk = ps->nchunks;
+  ps->found_index = ps->found_offset = -1;
+  pthread_mutex_init (&ps->lock, (pthread_mutexattr_t *)NULL);
+
+  if (nthreads > MAX_SEARCH_THREADS)
+    nthreads = MAX_SEARCH_THREADS;
+  if (nthreads > ps->nchunks)
+    nthreads = ps->nchunks;
+
+  /* If we can't create as many threads as requested, search with the
+     ones we have; the calling thread always takes part. */
+  for (nstarted = 0, i = 1; i < nthreads; i++)
+    if (pthread_create (&tids[nstarted], (pthread_attr_t *)NULL, psearch_thread, ps) == 0)
+      nstarted++;
+
+  psearch_worker (ps);
+
+  for (i = 0; i < nstarted; i++)
+    pthread_join (tids[i], (void **)NULL);
+
+  pthread_mutex_destroy (&ps->lock);
+  return (ps->found_index);
+}
+#endif /* HISTORY_PARALLEL_SEARCH */
+
 /* Search the history for STRING, starting at history_offset.
    If DIRECTION < 0, then the search is through previous entries, else
-   through subsequent.  If ANCHORED is non-zero, the string must
+   through subsequent.  If ANCHORED is ANCHORED_SEARCH, the string must
    appear at the beginning of a history line, otherwise, the string
-   may appear anywhere in the line.  If the string is found, then
+   may appear anywhere in the line.  If ANCHORED is REGEX_SEARCH, STRING
+   is a POSIX extended regular expression.  If the string is found, then
    current_history () is the history entry, and the value of this
    function is the offset in the line of that history entry that the
    string was found in.  Otherwise, nothing is changed, and a -1 is
@@ -64,10 +500,13 @@ history_search_internal (string, direction, anchored)
      int direction, anchored;
 {
   register int i, reverse;
-  register char *line;
-  register int line_index;
-  int string_len;
+  int string_len, offset;
   HIST_ENTRY **the_history; 	/* local */
+  HIST_REGEX *hre;
+#if defined (HISTORY_PARALLEL_SEARCH)
+  HIST_PSEARCH ps;
+  int nlines;
+#endif
 
   i = history_offset;
   reverse = (direction < 0);
@@ -82,75 +521,57 @@ history_search_internal (string, direction, anchored)
   if (reverse && (i >= history_length))
     i = history_length - 1;
 
-#define NEXT_LINE() do { if (reverse) i--; else i++; } while (0)
+  hre = (HIST_REGEX *)NULL;
+  if (anchored == REGEX_SEARCH)
+    {
+#if defined (HISTORY_REGEX_SEARCH)
+      hre = regex_cache_lookup (string);
+#endif
+      if (hre == 0)
+	return (-1);
+    }
 
   the_history = history_list ();
   string_len = strlen (string);
-  while (1)
-    {
-      /* Search each line in the history list for STRING. */
 
-      /* At limit for direction? */
-      if ((reverse && i < 0) || (!reverse && i == history_length))
+#if defined (HISTORY_PARALLEL_SEARCH)
+  nlines = reverse ? i + 1 : history_length - i;
+  if (history_search_threads > 1 && nlines >= PARALLEL_SEARCH_MIN)
+    {
+      ps.list = the_history;
+      ps.string = string;
+      ps.string_len = string_len;
+      ps.anchored = anchored;
+      ps.reverse = reverse;
+      ps.hre = hre;
+      ps.start = i;
+      ps.nlines = nlines;
+
+      i = history_search_parallel (&ps, history_search_threads);
+      if (i < 0)
 	return (-1);
+      history_offset = i;
+      return (ps.found_offset);
+    }
+#endif
 
-      line = the_history[i]->line;
-      line_index = strlen (line);
-
-      /* If STRING is longer than line, no match. */
-      if (string_len > line_index)
-	{
-	  NEXT_LINE ();
-	  continue;
-	}
-
-      /* Handle anchored searches first. */
-      if (anchored == ANCHORED_SEARCH)
-	{
-	  if (STREQN (string, line, string_len))
-	    {
-	      history_offset = i;
-	      return (0);
-	    }
-
-	  NEXT_LINE ();
-	  continue;
-	}
-
-      /* Do substring search. */
-      if (reverse)
-	{
-	  line_index -= string_len;
+#define NEXT_LINE() do { if (reverse) i--; else i++; } while (0)
 
-	  while (line_index >= 0)
-	    {
-	      if (STREQN (string, line + line_index, string_len))
-		{
-		  history_offset = i;
-		  return (line_index);
-		}
-	      line_index--;
-	    }
-	}
-      else
+  /* Search each line in the history list for STRING, stopping at the
+     limit for DIRECTION. */
+  while (reverse ? (i >= 0) : (i < history_length))
+    {
+      offset = history_search_line (the_history[i]->line, string, string_len,
+				    anchored, reverse, hre);
+      if (offset >= 0)
 	{
-	  register int limit;
-
-	  limit = line_index - string_len + 1;
-	  line_index = 0;
-
-	  while (line_index < limit)
-	    {
-	      if (STREQN (string, line + line_index, string_len))
-		{
-		  history_offset = i;
-		  return (line_index);
-		}
-	      line_index++;
-	    }
+	  history_offset = i;
+	  return (offset);
 	}
       NEXT_LINE ();
     }
+
+  return (-1);
 }
 
 /* Do a non-anchored search for STRING through the history in DIRECTION. */
@@ -171,6 +592,17 @@ history_search_prefix (string, direction)
   return (history_search_internal (string, direction, ANCHORED_SEARCH));
 }
 
+/* Search the history in DIRECTION for a line matching PATTERN, a POSIX
+   extended regular expression.  Returns the offset of the match in the
+   line, or -1 if there is no match or PATTERN is invalid. */
+int
+history_search_regex (pattern, direction)
+     const char *pattern;
+     int direction;
+{
+  return (history_search_internal (pattern, direction, REGEX_SEARCH));
+}
+
 /* Search for STRING in the history list.  DIR is < 0 for searching
    backwards.  POS is an absolute index into the history list at
    which point to begin searching. */
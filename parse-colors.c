@@ -311,6 +311,7 @@ void _rl_parse_colors()
   if (p == 0 || *p == '\0')
     {
       _rl_color_ext_list = NULL;
+      _rl_compile_color_ext_list ();
       return;
     }
 
@@ -434,6 +435,8 @@ void _rl_parse_colors()
       _rl_color_ext_list = NULL;
       _rl_colored_stats = 0;	/* can't have colored stats without colors */
     }
+
+  _rl_compile_color_ext_list ();
 #else /* !COLOR_SUPPORT */
   ;
 #endif /* !COLOR_SUPPORT */
@@ -0,0 +1,1263 @@
+/* pathindex.c -- an index of the files in a directory tree, so pathnames
+		  can be completed from anywhere in the tree. */
+
+/* Copyright (C) 2016 Free Software Foundation, Inc.
+
+   This file is part of the GNU Readline Library (Readline), a library
+   for reading lines of text with interactive input and history editing.
+
+   Readline is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Readline is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Readline.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define READLINE_LIBRARY
+
+#if defined (HAVE_CONFIG_H)
+#  include <config.h>
+#endif
+
+#include <sys/types.h>
+#include <fcntl.h>
+#include <signal.h>
+
+#if defined (HAVE_UNISTD_H)
+#  include <unistd.h>
+#endif /* HAVE_UNISTD_H */
+
+#if defined (HAVE_STDLIB_H)
+#  include <stdlib.h>
+#else
+#  include "ansi_stdlib.h"
+#endif /* HAVE_STDLIB_H */
+
+#include <stdio.h>
+#include <time.h>
+
+#include <errno.h>
+#if !defined (errno)
+extern int errno;
+#endif /* !errno */
+
+#include "posixdir.h"
+#include "posixstat.h"
+#include "posixselect.h"
+
+/* System-specific feature definitions and include files. */
+#include "rldefs.h"
+
+/* Some standard library routines. */
+#include "readline.h"
+#include "xmalloc.h"
+#include "rlprivate.h"
+
+#ifdef HAVE_LSTAT
+#  define LSTAT lstat
+#else
+#  define LSTAT stat
+#endif
+
+/* The index is kept up to date by a thread of its own where we have
+   threads; otherwise completing checks it every so often. */
+#if defined (HAVE_PTHREAD_H) && defined (HAVE_PTHREAD_CREATE) && defined (HAVE_SELECT)
+#  define PATH_INDEX_THREADS
+#  include <pthread.h>
+#endif
+
+/* The indexing thread finds out about changes from inotify(7) where it
+   can, and by checking the directories' modification times otherwise. */
+#if defined (PATH_INDEX_THREADS) && defined (HAVE_SYS_INOTIFY_H) && defined (HAVE_INOTIFY_INIT1)
+#  define PATH_INDEX_INOTIFY
+#  include <sys/inotify.h>
+#endif
+
+/* A directory in the index.  NAMES are the directory's entries, sorted.
+   CHILD[i] is the index in `dirs' of the subdirectory NAMES[i], or -1 if
+   NAMES[i] isn't a directory we index.  We don't follow symbolic links
+   or look in directories whose names begin with a `.'. */
+typedef struct _index_dir {
+  char *path;		/* relative to the root, with a trailing slash; "" for the root */
+  char **names;
+  int *child;
+  int nnames;
+  time_t mtime;		/* modification time when last read; 0 to read it again */
+  int parent;		/* -1 for the root; FREE_DIR if the slot is unused */
+  int wd;		/* inotify watch descriptor, or -1 */
+  int stale;		/* non-zero means read it again before the next snapshot */
+} INDEX_DIR;
+
+#define FREE_DIR	-2
+
+/* A name read from a directory, and whether the directory entry says it's
+   a directory: 1 if so, 0 if not, -1 if it doesn't say. */
+typedef struct _index_entry {
+  char *name;
+  int isdir;
+} INDEX_ENTRY;
+
+/* One way into a pathname in a snapshot: KEY points to the start of one
+   of the components of the pathname with index PATH. */
+typedef struct _index_key {
+  char *key;
+  int path;
+} INDEX_KEY;
+
+/* What completion searches: a copy of the index with every pathname
+   spelled out, and the keys sorted without regard to case (and by byte
+   among keys differing only in case), so the keys beginning with some
+   text are together whether or not case is ignored.  The thread that
+   keeps the index up to date makes a new snapshot whenever the tree
+   changes and swaps it in while holding index_lock. */
+typedef struct _index_snapshot {
+  char **paths;
+  int npaths;
+  INDEX_KEY *keys;
+  int nkeys;
+  char *pool;
+} INDEX_SNAPSHOT;
+
+/* The first line of an index file. */
+#define INDEX_FILE_MAGIC	"# readline path index 1"
+
+#if defined (PATH_INDEX_INOTIFY)
+#  define INDEX_WATCH_EVENTS \
+	(IN_CREATE|IN_DELETE|IN_MOVED_FROM|IN_MOVED_TO|IN_ONLYDIR|IN_DONT_FOLLOW)
+/* How long to wait for more events after one arrives before updating the
+   index, so something like unpacking an archive causes one update. */
+#  define INDEX_SETTLE_USEC	100000
+#  define INDEX_SETTLE_MAX	10
+#endif
+
+static int new_dir PARAMS((char *, int));
+static void free_dir_tree PARAMS((int));
+static void free_dirs PARAMS((void));
+static char *dir_fullpath PARAMS((int, const char *));
+static void watch_dir PARAMS((int));
+static int entry_compare PARAMS((const void *, const void *));
+static int read_dir PARAMS((int));
+static int refresh_index PARAMS((int));
+
+static int key_compare PARAMS((const void *, const void *));
+static int int_compare PARAMS((const void *, const void *));
+static INDEX_SNAPSHOT *build_snapshot PARAMS((void));
+static void free_snapshot PARAMS((INDEX_SNAPSHOT *));
+static void publish_snapshot PARAMS((void));
+static int find_indexed_paths PARAMS((const char *, char ***));
+
+static char *read_index_line PARAMS((FILE *, char **, size_t *));
+static int load_index PARAMS((void));
+static void save_index PARAMS((void));
+static void update_index PARAMS((int));
+
+#if defined (PATH_INDEX_THREADS)
+static void *index_thread_main PARAMS((void *));
+#endif
+#if defined (PATH_INDEX_INOTIFY)
+static int read_index_events PARAMS((void));
+#endif
+
+/* **************************************************************** */
+/*								    */
+/*			Indexed Path Completion			    */
+/*								    */
+/* **************************************************************** */
+
+/* The number of seconds between checks of the modification times of the
+   indexed directories that aren't being watched for changes.  Zero or
+   less means only check when rl_path_index_refresh() is called. */
+int rl_path_index_interval = 5;
+
+/* The root of the tree, as passed to rl_path_index_start, and what we put
+   in front of the pathnames in the index to make the matches. */
+static char *index_root = (char *)NULL;
+static char *index_prefix = (char *)NULL;
+
+/* Where the index is kept between sessions; NULL if it isn't. */
+static char *index_file = (char *)NULL;
+
+static int index_active = 0;
+
+/* The directories in the tree.  The root is always dirs[0].  Only the
+   thread keeping the index up to date looks at these while it runs. */
+static INDEX_DIR *dirs = (INDEX_DIR *)NULL;
+static int ndirs, dirs_size;
+
+/* Slots in DIRS that directories no longer in the tree have given up. */
+static int *unused_dirs = (int *)NULL;
+static int nunused, unused_size;
+
+/* When the index was last brought up to date. */
+static time_t last_refresh;
+
+/* The snapshot completion searches; NULL until the first is made. */
+static INDEX_SNAPSHOT *snapshot = (INDEX_SNAPSHOT *)NULL;
+
+#if defined (PATH_INDEX_THREADS)
+static pthread_mutex_t index_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t index_thread;
+static int index_threaded = 0;
+
+/* Writing a byte to wake_fds[1] wakes the indexing thread: `r' asks it to
+   check every directory and `q' to exit. */
+static int wake_fds[2] = { -1, -1 };
+static volatile int index_stopping = 0;
+
+/* The longest the thread waits without looking at index_stopping, so
+   rl_path_index_stop can't wait forever if it couldn't write to
+   wake_fds. */
+#  define INDEX_STOP_POLL	1
+
+#  define LOCK_INDEX()		pthread_mutex_lock (&index_lock)
+#  define UNLOCK_INDEX()	pthread_mutex_unlock (&index_lock)
+#  define INDEX_STOPPING()	(index_stopping)
+#else
+#  define LOCK_INDEX()
+#  define UNLOCK_INDEX()
+#  define INDEX_STOPPING()	0
+#endif
+
+#if defined (PATH_INDEX_INOTIFY)
+static int inotify_fd = -1;
+
+/* The directory each watch descriptor watches, indexed by descriptor;
+   -1 if none.  Linux hands out descriptors in increasing order. */
+static int *wd_dirs = (int *)NULL;
+static int wd_dirs_size;
+#endif
+
+/* Return a slot in DIRS for the directory PATH, a subdirectory of the
+   directory with index PARENT, marked to be read.  PATH is not copied. */
+static int
+new_dir (path, parent)
+     char *path;
+     int parent;
+{
+  int d;
+
+  if (nunused)
+    d = unused_dirs[--nunused];
+  else
+    {
+      if (ndirs == dirs_size)
+	{
+	  dirs_size = dirs_size ? dirs_size * 2 : 64;
+	  dirs = (INDEX_DIR *)xrealloc (dirs, dirs_size * sizeof (INDEX_DIR));
+	}
+      d = ndirs++;
+    }
+
+  dirs[d].path = path;
+  dirs[d].names = (char **)NULL;
+  dirs[d].child = (int *)NULL;
+  dirs[d].nnames = 0;
+  dirs[d].mtime = 0;
+  dirs[d].parent = parent;
+  dirs[d].wd = -1;
+  dirs[d].stale = 1;
+  return d;
+}
+
+/* Remove the directory with index D and everything beneath it from the
+   index. */
+static void
+free_dir_tree (d)
+     int d;
+{
+  int i;
+
+  for (i = 0; i < dirs[d].nnames; i++)
+    {
+      if (dirs[d].child[i] >= 0)
+	free_dir_tree (dirs[d].child[i]);
+      xfree (dirs[d].names[i]);
+    }
+  FREE (dirs[d].names);
+  FREE (dirs[d].child);
+  xfree (dirs[d].path);
+
+#if defined (PATH_INDEX_INOTIFY)
+  if (dirs[d].wd >= 0)
+    {
+      inotify_rm_watch (inotify_fd, dirs[d].wd);
+      wd_dirs[dirs[d].wd] = -1;
+    }
+#endif
+
+  dirs[d].parent = FREE_DIR;
+  if (nunused == unused_size)
+    {
+      unused_size = unused_size ? unused_size * 2 : 64;
+      unused_dirs = (int *)xrealloc (unused_dirs, unused_size * sizeof (int));
+    }
+  unused_dirs[nunused++] = d;
+}
+
+static void
+free_dirs ()
+{
+  if (ndirs && dirs[0].parent != FREE_DIR)
+    free_dir_tree (0);
+  FREE (dirs);
+  FREE (unused_dirs);
+  dirs = (INDEX_DIR *)NULL;
+  unused_dirs = (int *)NULL;
+  ndirs = dirs_size = nunused = unused_size = 0;
+}
+
+/* Return the pathname of NAME in the directory with index D, or of the
+   directory itself if NAME is NULL, as the application would see it. */
+static char *
+dir_fullpath (d, name)
+     int d;
+     const char *name;
+{
+  char *path;
+  int plen;
+
+  plen = strlen (index_prefix);
+  path = (char *)xmalloc (plen + strlen (dirs[d].path) + (name ? strlen (name) : 0) + 2);
+  strcpy (path, index_prefix);
+  strcpy (path + plen, dirs[d].path);
+  if (name)
+    strcat (path, name);
+  else if (*path == '\0')
+    strcpy (path, ".");
+  return path;
+}
+
+/* Ask to be told when entries are added to or removed from the directory
+   with index D. */
+static void
+watch_dir (d)
+     int d;
+{
+#if defined (PATH_INDEX_INOTIFY)
+  char *path;
+  int wd, n;
+
+  if (inotify_fd < 0 || dirs[d].wd >= 0)
+    return;
+
+  path = dir_fullpath (d, (char *)NULL);
+  wd = inotify_add_watch (inotify_fd, path, INDEX_WATCH_EVENTS);
+  xfree (path);
+  if (wd < 0)
+    return;		/* probably out of watches; check its mtime instead */
+
+  if (wd >= wd_dirs_size)
+    {
+      n = wd_dirs_size;
+      wd_dirs_size = (wd >= 2 * wd_dirs_size) ? wd + 64 : 2 * wd_dirs_size;
+      wd_dirs = (int *)xrealloc (wd_dirs, wd_dirs_size * sizeof (int));
+      while (n < wd_dirs_size)
+	wd_dirs[n++] = -1;
+    }
+  wd_dirs[wd] = d;
+  dirs[d].wd = wd;
+#endif
+}
+
+static int
+entry_compare (a, b)
+     const void *a, *b;
+{
+  return (strcmp (((const INDEX_ENTRY *)a)->name, ((const INDEX_ENTRY *)b)->name));
+}
+
+/* Read the directory with index D again, adding the subdirectories that
+   have appeared to the index (to be read in turn) and removing the ones
+   that have gone.  Returns non-zero if the entries changed. */
+static int
+read_dir (d)
+     int d;
+{
+  DIR *dp;
+  struct dirent *dentry;
+  struct stat finfo;
+  INDEX_ENTRY *entries;
+  char *path, *name, **names, **onames;
+  int *child, *ochild;
+  int nnames, size, onnames, changed, isdir, i, j, r;
+  time_t now, mtime;
+
+  watch_dir (d);
+
+  dirs[d].stale = 0;
+  path = dir_fullpath (d, (char *)NULL);
+  now = time ((time_t *)NULL);
+  if (stat (path, &finfo) == 0 && S_ISDIR (finfo.st_mode))
+    {
+      mtime = finfo.st_mtime;
+      dp = opendir (path);
+    }
+  else
+    {
+      mtime = 0;
+      dp = (DIR *)NULL;
+    }
+  xfree (path);
+
+  entries = (INDEX_ENTRY *)NULL;
+  nnames = size = 0;
+  while (dp && (dentry = readdir (dp)))
+    {
+      name = dentry->d_name;
+      if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+	continue;
+      /* Index files use a line per name. */
+      if (strchr (name, '\n'))
+	continue;
+
+      if (nnames == size)
+	{
+	  size = size ? size * 2 : 32;
+	  entries = (INDEX_ENTRY *)xrealloc (entries, size * sizeof (INDEX_ENTRY));
+	}
+      entries[nnames].name = savestring (name);
+#if defined (HAVE_STRUCT_DIRENT_D_TYPE) && defined (DT_UNKNOWN)
+      entries[nnames].isdir = (dentry->d_type == DT_UNKNOWN) ? -1 : (dentry->d_type == DT_DIR);
+#else
+      entries[nnames].isdir = -1;
+#endif
+      nnames++;
+    }
+  if (dp)
+    closedir (dp);
+
+  if (nnames > 1)
+    qsort (entries, nnames, sizeof (INDEX_ENTRY), entry_compare);
+  names = (char **)xmalloc ((nnames + 1) * sizeof (char *));
+  child = (int *)xmalloc ((nnames + 1) * sizeof (int));
+  for (j = 0; j < nnames; j++)
+    names[j] = entries[j].name;
+
+  /* Both lists are sorted, so we can merge them to find what's changed.
+     new_dir may move DIRS, so we don't keep pointers into it. */
+  onames = dirs[d].names;
+  ochild = dirs[d].child;
+  onnames = dirs[d].nnames;
+  changed = nnames != onnames;
+  for (i = j = 0; i < onnames || j < nnames; )
+    {
+      r = (i == onnames) ? 1 : ((j == nnames) ? -1 : strcmp (onames[i], names[j]));
+      if (r < 0)		/* removed */
+	{
+	  if (ochild[i] >= 0)
+	    free_dir_tree (ochild[i]);
+	  xfree (onames[i++]);
+	  changed = 1;
+	  continue;
+	}
+      else if (r == 0)
+	{
+	  child[j++] = ochild[i];
+	  xfree (onames[i++]);
+	  continue;
+	}
+
+      /* Added. */
+      changed = 1;
+      name = names[j];
+      isdir = (name[0] == '.') ? 0 : entries[j].isdir;
+      if (isdir < 0)
+	{
+	  path = dir_fullpath (d, name);
+	  isdir = LSTAT (path, &finfo) == 0 && S_ISDIR (finfo.st_mode);
+	  xfree (path);
+	}
+      if (isdir)
+	{
+	  path = (char *)xmalloc (strlen (dirs[d].path) + strlen (name) + 2);
+	  sprintf (path, "%s%s/", dirs[d].path, name);
+	  child[j] = new_dir (path, d);
+	}
+      else
+	child[j] = -1;
+      j++;
+    }
+  FREE (onames);
+  FREE (ochild);
+  FREE (entries);
+
+  dirs[d].names = names;
+  dirs[d].child = child;
+  dirs[d].nnames = nnames;
+
+  /* A directory changed in the same second we read it could change again
+     without its modification time changing, so read it again next time. */
+  dirs[d].mtime = (mtime < now) ? mtime : 0;
+
+  return changed;
+}
+
+/* Bring the index up to date by reading the directories marked stale.
+   If CHECK is 1, first mark as stale the directories we aren't watching
+   whose modification times have changed; if it's 2, check all of them.
+   Returns non-zero if anything changed. */
+static int
+refresh_index (check)
+     int check;
+{
+  struct stat finfo;
+  char *path;
+  int d, nread, changed;
+
+  if (ndirs == 0)
+    new_dir (savestring (""), -1);
+
+  for (d = 0; check && d < ndirs; d++)
+    {
+      if (dirs[d].parent == FREE_DIR || dirs[d].stale || (check == 1 && dirs[d].wd >= 0))
+	continue;
+      path = dir_fullpath (d, (char *)NULL);
+      if (stat (path, &finfo) < 0 || finfo.st_mtime != dirs[d].mtime)
+	dirs[d].stale = 1;
+      xfree (path);
+    }
+
+  /* Reading a directory can add new ones, in unused slots anywhere. */
+  changed = 0;
+  do
+    {
+      for (d = nread = 0; d < ndirs && INDEX_STOPPING () == 0; d++)
+	if (dirs[d].parent != FREE_DIR && dirs[d].stale)
+	  {
+	    changed |= read_dir (d);
+	    nread++;
+	  }
+    }
+  while (nread);
+
+  last_refresh = time ((time_t *)NULL);
+  return changed;
+}
+
+static int
+key_compare (a, b)
+     const void *a, *b;
+{
+  const INDEX_KEY *ka, *kb;
+  int r;
+
+  ka = (const INDEX_KEY *)a;
+  kb = (const INDEX_KEY *)b;
+  r = _rl_stricmp (ka->key, kb->key);
+  return (r ? r : strcmp (ka->key, kb->key));
+}
+
+static int
+int_compare (a, b)
+     const void *a, *b;
+{
+  return (*(const int *)a - *(const int *)b);
+}
+
+/* Make a snapshot of the index.  Directories' pathnames don't have the
+   trailing slash, as rl_filename_completion_function returns them. */
+static INDEX_SNAPSHOT *
+build_snapshot ()
+{
+  INDEX_SNAPSHOT *s;
+  size_t psize, pind;
+  char *p, *t;
+  int d, i, n, k;
+
+  s = (INDEX_SNAPSHOT *)xmalloc (sizeof (INDEX_SNAPSHOT));
+
+  for (d = n = k = 0, psize = 0; d < ndirs; d++)
+    {
+      if (dirs[d].parent == FREE_DIR || dirs[d].nnames == 0)
+	continue;
+      n += dirs[d].nnames;
+      /* Each pathname has a key for each directory above it, too. */
+      for (t = dirs[d].path; *t; t++)
+	k += (*t == '/') * dirs[d].nnames;
+      psize += dirs[d].nnames * strlen (dirs[d].path);
+      for (i = 0; i < dirs[d].nnames; i++)
+	psize += strlen (dirs[d].names[i]) + 1;
+    }
+  k += n;
+
+  s->paths = (char **)xmalloc ((n + 1) * sizeof (char *));
+  s->keys = (INDEX_KEY *)xmalloc ((k + 1) * sizeof (INDEX_KEY));
+  s->pool = (char *)xmalloc (psize + 1);
+  s->npaths = s->nkeys = 0;
+
+  for (d = pind = 0; d < ndirs; d++)
+    {
+      if (dirs[d].parent == FREE_DIR)
+	continue;
+      for (i = 0; i < dirs[d].nnames; i++)
+	{
+	  p = s->pool + pind;
+	  strcpy (p, dirs[d].path);
+	  strcat (p, dirs[d].names[i]);
+	  pind += strlen (p) + 1;
+
+	  s->keys[s->nkeys].key = p;
+	  s->keys[s->nkeys++].path = s->npaths;
+	  for (t = p; (t = strchr (t, '/')); )
+	    {
+	      s->keys[s->nkeys].key = ++t;
+	      s->keys[s->nkeys++].path = s->npaths;
+	    }
+	  s->paths[s->npaths++] = p;
+	}
+    }
+  s->paths[s->npaths] = (char *)NULL;
+
+  if (s->nkeys > 1)
+    qsort (s->keys, s->nkeys, sizeof (INDEX_KEY), key_compare);
+
+  return s;
+}
+
+static void
+free_snapshot (s)
+     INDEX_SNAPSHOT *s;
+{
+  if (s == 0)
+    return;
+  xfree (s->paths);
+  xfree (s->keys);
+  xfree (s->pool);
+  xfree (s);
+}
+
+/* Make a new snapshot of the index and let completion use it. */
+static void
+publish_snapshot ()
+{
+  INDEX_SNAPSHOT *new, *old;
+
+  new = build_snapshot ();
+  LOCK_INDEX ();
+  old = snapshot;
+  snapshot = new;
+  UNLOCK_INDEX ();
+  free_snapshot (old);
+}
+
+/* Find the indexed pathnames with a component beginning with TEXT, and
+   return copies of them, as the application would see them, in a new
+   NULL-terminated array in *PATHSP.  Returns the number found, or -1 if
+   there isn't an index to search yet. */
+static int
+find_indexed_paths (text, pathsp)
+     const char *text;
+     char ***pathsp;
+{
+  INDEX_SNAPSHOT *s;
+  char **paths;
+  int *found, tlen, lo, hi, mid, n, i, j;
+
+  LOCK_INDEX ();
+  s = snapshot;
+  if (s == 0)
+    {
+      UNLOCK_INDEX ();
+      return -1;
+    }
+
+  tlen = strlen (text);
+  for (lo = 0, hi = s->nkeys; lo < hi; )
+    {
+      mid = (lo + hi) / 2;
+      if (_rl_strnicmp (s->keys[mid].key, text, tlen) < 0)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+  for (hi = lo; hi < s->nkeys && _rl_strnicmp (s->keys[hi].key, text, tlen) == 0; hi++)
+    ;
+
+  /* A pathname can match at more than one of its components. */
+  found = (int *)xmalloc ((hi - lo + 1) * sizeof (int));
+  for (n = 0, i = lo; i < hi; i++)
+    if (_rl_completion_case_fold || strncmp (s->keys[i].key, text, tlen) == 0)
+      found[n++] = s->keys[i].path;
+  if (n > 1)
+    qsort (found, n, sizeof (int), int_compare);
+
+  paths = (char **)xmalloc ((n + 1) * sizeof (char *));
+  for (i = j = 0; i < n; i++)
+    {
+      if (i && found[i] == found[i - 1])
+	continue;
+      paths[j] = (char *)xmalloc (strlen (index_prefix) + strlen (s->paths[found[i]]) + 1);
+      strcpy (paths[j], index_prefix);
+      strcat (paths[j], s->paths[found[i]]);
+      j++;
+    }
+  paths[j] = (char *)NULL;
+  UNLOCK_INDEX ();
+
+  xfree (found);
+  *pathsp = paths;
+  return j;
+}
+
+/* Read a line from FP into *BUFP, which has *SIZEP bytes allocated, and
+   return it without the newline.  Returns NULL at EOF or if the line is
+   incomplete. */
+static char *
+read_index_line (fp, bufp, sizep)
+     FILE *fp;
+     char **bufp;
+     size_t *sizep;
+{
+  size_t len;
+
+  for (len = 0; ; )
+    {
+      if (*sizep - len < 2)
+	{
+	  *sizep = *sizep ? *sizep * 2 : 256;
+	  *bufp = (char *)xrealloc (*bufp, *sizep);
+	}
+      if (fgets (*bufp + len, *sizep - len, fp) == 0)
+	return ((char *)NULL);
+      len += strlen (*bufp + len);
+      if (len && (*bufp)[len - 1] == '\n')
+	{
+	  (*bufp)[len - 1] = '\0';
+	  return (*bufp);
+	}
+    }
+}
+
+/* Read the index saved in index_file, if there is one for this root.
+   The file has a line for each directory:
+
+	D parent mtime path
+
+   followed by a line for each of its entries:
+
+	d child name	(a subdirectory in the index)
+	f name		(anything else)
+
+   where directories are numbered from 0 in the order they appear, which
+   puts each after its parent, and the root comes first.  The
+   directories still have to be checked for changes; we start watching
+   them first so nothing that changes after the check is missed.
+   Returns non-zero if the index was read. */
+static int
+load_index ()
+{
+  FILE *fp;
+  char *line, *name, *t, *seen;
+  size_t lsize;
+  int d, n, size, child, parent, ok;
+  long mtime;
+
+  mtime = 0;
+  if (index_file == 0 || (fp = fopen (index_file, "r")) == 0)
+    return 0;
+
+  line = (char *)NULL;
+  lsize = 0;
+  ok = read_index_line (fp, &line, &lsize) && STREQ (line, INDEX_FILE_MAGIC) &&
+       read_index_line (fp, &line, &lsize) && STREQ (line, index_root);
+
+  d = -1;
+  size = 0;
+  while (ok && (ok = read_index_line (fp, &line, &lsize) != 0))
+    {
+      if (line[0] == 'E' && line[1] == '\0')
+	break;
+      if ((line[0] != 'D' && line[0] != 'd' && line[0] != 'f') || line[1] != ' ')
+	{
+	  ok = 0;
+	  break;
+	}
+
+      if (line[0] == 'D')
+	{
+	  parent = strtol (line + 2, &t, 10);
+	  if (*t == ' ')
+	    mtime = strtol (t + 1, &t, 10);
+	  if (*t != ' ' || parent < -1 || parent >= ndirs || (parent < 0) != (ndirs == 0))
+	    {
+	      ok = 0;
+	      break;
+	    }
+	  d = new_dir (savestring (t + 1), parent);
+	  dirs[d].mtime = mtime;
+	  dirs[d].stale = 0;
+	  size = 0;
+	  continue;
+	}
+
+      if (d < 0)
+	{
+	  ok = 0;
+	  break;
+	}
+      child = -1;
+      name = line + 2;
+      if (line[0] == 'd')
+	{
+	  child = strtol (name, &t, 10);
+	  if (*t != ' ' || child <= d)
+	    {
+	      ok = 0;
+	      break;
+	    }
+	  name = t + 1;
+	}
+      n = dirs[d].nnames;
+      if (n + 1 >= size)
+	{
+	  size = size ? size * 2 : 32;
+	  dirs[d].names = (char **)xrealloc (dirs[d].names, size * sizeof (char *));
+	  dirs[d].child = (int *)xrealloc (dirs[d].child, size * sizeof (int));
+	}
+      dirs[d].names[n] = savestring (name);
+      dirs[d].child[n] = child;
+      dirs[d].nnames++;
+    }
+
+  /* Make sure every directory but the root is the subdirectory of its
+     parent exactly once, so the index is a tree free_dir_tree can walk. */
+  seen = ok ? (char *)xmalloc (ndirs) : (char *)NULL;
+  if (seen)
+    memset (seen, 0, ndirs);
+  for (d = 0; ok && d < ndirs; d++)
+    for (n = 0; ok && n < dirs[d].nnames; n++)
+      {
+	child = dirs[d].child[n];
+	if (child < 0)
+	  continue;
+	if (child >= ndirs || dirs[child].parent != d || seen[child])
+	  ok = 0;
+	else
+	  seen[child] = 1;
+      }
+  for (d = 1; ok && d < ndirs; d++)
+    if (seen[d] == 0)
+      ok = 0;
+  FREE (seen);
+
+  FREE (line);
+  fclose (fp);
+
+  if (ok == 0)
+    {
+      /* The links between directories can't be trusted, so free each
+	 directory by itself. */
+      for (d = 0; d < ndirs; d++)
+	if (dirs[d].parent != FREE_DIR)
+	  {
+	    for (n = 0; n < dirs[d].nnames; n++)
+	      dirs[d].child[n] = -1;
+	    free_dir_tree (d);
+	  }
+      free_dirs ();
+      return 0;
+    }
+
+  for (d = 0; d < ndirs; d++)
+    watch_dir (d);
+  return 1;
+}
+
+/* Save the index in index_file.  The directories are written parents
+   first, numbered in that order.  We write a new file and rename it, so
+   readers never see a partly written index. */
+static void
+save_index ()
+{
+  FILE *fp;
+  char *tempname;
+  int *order, *number, d, i, n, c;
+
+  if (index_file == 0 || ndirs == 0)
+    return;
+
+  tempname = (char *)xmalloc (strlen (index_file) + 5);
+  sprintf (tempname, "%s.tmp", index_file);
+  if ((fp = fopen (tempname, "w")) == 0)
+    {
+      xfree (tempname);
+      return;
+    }
+
+  /* Number the directories breadth first from the root. */
+  order = (int *)xmalloc (ndirs * sizeof (int));
+  number = (int *)xmalloc (ndirs * sizeof (int));
+  order[0] = 0;
+  number[0] = 0;
+  for (d = 0, n = 1; d < n; d++)
+    for (i = 0; i < dirs[order[d]].nnames; i++)
+      if ((c = dirs[order[d]].child[i]) >= 0)
+	{
+	  number[c] = n;
+	  order[n++] = c;
+	}
+
+  fprintf (fp, "%s\n%s\n", INDEX_FILE_MAGIC, index_root);
+  for (d = 0; d < n; d++)
+    {
+      c = order[d];
+      fprintf (fp, "D %d %ld %s\n", c ? number[dirs[c].parent] : -1,
+			      (long)dirs[c].mtime, dirs[c].path);
+      for (i = 0; i < dirs[c].nnames; i++)
+	if (dirs[c].child[i] >= 0)
+	  fprintf (fp, "d %d %s\n", number[dirs[c].child[i]], dirs[c].names[i]);
+	else
+	  fprintf (fp, "f %s\n", dirs[c].names[i]);
+    }
+  fprintf (fp, "E\n");
+  xfree (order);
+  xfree (number);
+
+  if (ferror (fp) | fclose (fp) || rename (tempname, index_file) < 0)
+    unlink (tempname);
+  xfree (tempname);
+}
+
+/* Bring the index up to date as refresh_index does, and publish and save
+   it if it changed. */
+static void
+update_index (check)
+     int check;
+{
+  if (refresh_index (check) || snapshot == 0)
+    {
+      publish_snapshot ();
+      save_index ();
+    }
+}
+
+#if defined (PATH_INDEX_INOTIFY)
+/* Mark the directories inotify says have changed as stale.  Returns 1 if
+   any were, 2 if events were lost and every directory must be checked,
+   and 0 otherwise. */
+static int
+read_index_events ()
+{
+  union {
+    struct inotify_event ev;
+    char buf[4096];
+  } u;
+  struct inotify_event *ev;
+  char *p;
+  ssize_t n;
+  int r, d;
+
+  r = 0;
+  while ((n = read (inotify_fd, u.buf, sizeof (u.buf))) > 0)
+    for (p = u.buf; p < u.buf + n; p += sizeof (struct inotify_event) + ev->len)
+      {
+	ev = (struct inotify_event *)p;
+	if (ev->mask & IN_Q_OVERFLOW)
+	  r = 2;
+	if (ev->wd < 0 || ev->wd >= wd_dirs_size || (d = wd_dirs[ev->wd]) < 0)
+	  continue;
+	if (ev->mask & IN_IGNORED)	/* directory is gone */
+	  {
+	    wd_dirs[ev->wd] = -1;
+	    dirs[d].wd = -1;
+	  }
+	else
+	  {
+	    dirs[d].stale = 1;
+	    if (r == 0)
+	      r = 1;
+	  }
+      }
+  return r;
+}
+#endif
+
+#if defined (PATH_INDEX_THREADS)
+/* The thread that keeps the index up to date.  Signals are blocked so
+   they are always handled by the application's threads. */
+static void *
+index_thread_main (arg)
+     void *arg;
+{
+  sigset_t set;
+  fd_set readfds;
+  struct timeval timeout, *tp;
+  int maxfd, check, pending, polling, n;
+  char c;
+
+  sigfillset (&set);
+  pthread_sigmask (SIG_BLOCK, &set, (sigset_t *)NULL);
+
+  if (load_index ())
+    publish_snapshot ();
+  update_index (2);
+
+  for (pending = 0; INDEX_STOPPING () == 0; )
+    {
+      FD_ZERO (&readfds);
+      FD_SET (wake_fds[0], &readfds);
+      maxfd = wake_fds[0];
+#if defined (PATH_INDEX_INOTIFY)
+      if (inotify_fd >= 0)
+	{
+	  FD_SET (inotify_fd, &readfds);
+	  if (inotify_fd > maxfd)
+	    maxfd = inotify_fd;
+	}
+      if (pending)
+	{
+	  USEC_TO_TIMEVAL (INDEX_SETTLE_USEC, timeout);
+	  tp = &timeout;
+	  polling = 0;
+	}
+      else
+#endif
+	{
+	  timeout.tv_sec = (rl_path_index_interval > 0 && rl_path_index_interval < INDEX_STOP_POLL)
+				? rl_path_index_interval : INDEX_STOP_POLL;
+	  timeout.tv_usec = 0;
+	  tp = &timeout;
+	  polling = 1;
+	}
+
+      n = select (maxfd + 1, &readfds, (fd_set *)NULL, (fd_set *)NULL, tp);
+      if (n < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  break;
+	}
+
+      check = 0;
+      if (n > 0 && FD_ISSET (wake_fds[0], &readfds))
+	{
+	  while (read (wake_fds[0], &c, 1) == 1)
+	    if (c == 'q')
+	      return ((void *)NULL);
+	    else
+	      check = 2;
+	}
+#if defined (PATH_INDEX_INOTIFY)
+      if (n > 0 && inotify_fd >= 0 && FD_ISSET (inotify_fd, &readfds))
+	{
+	  if (read_index_events () == 2)
+	    check = 2;
+	  /* Wait for things to settle, but not forever. */
+	  else if (check == 0 && ++pending < INDEX_SETTLE_MAX)
+	    continue;
+	}
+      pending = 0;
+#endif
+      if (n == 0 && check == 0)
+	{
+	  /* Only check the directories every rl_path_index_interval
+	     seconds, however often we wake up. */
+	  if (polling && (rl_path_index_interval <= 0 ||
+			  time ((time_t *)NULL) - last_refresh < rl_path_index_interval))
+	    continue;
+	  check = 1;
+	}
+      update_index (check);
+    }
+
+  return ((void *)NULL);
+}
+#endif
+
+/* Start indexing the directory tree at ROOT for
+   rl_indexed_path_completion_function.  If FILE is non-NULL, the index is
+   kept there between sessions, so it's available as soon as it's read;
+   it's checked for changes as the tree is.  Where threads are available,
+   indexing happens on a thread of its own and this returns at once.
+   Returns 0, or -1 with errno set if ROOT isn't a directory. */
+int
+rl_path_index_start (root, file)
+     const char *root, *file;
+{
+  struct stat finfo;
+  int rlen;
+
+  if (stat (root, &finfo) < 0)
+    return -1;
+  if (S_ISDIR (finfo.st_mode) == 0)
+    {
+      errno = ENOTDIR;
+      return -1;
+    }
+
+  rl_path_index_stop ();
+
+  index_root = savestring (root);
+  rlen = strlen (index_root);
+  while (rlen > 1 && index_root[rlen - 1] == '/')
+    index_root[--rlen] = '\0';
+  index_prefix = (char *)xmalloc (rlen + 2);
+  if (STREQ (index_root, "."))
+    index_prefix[0] = '\0';
+  else
+    sprintf (index_prefix, (index_root[rlen - 1] == '/') ? "%s" : "%s/", index_root);
+  index_file = file ? savestring (file) : (char *)NULL;
+  index_active = 1;
+
+#if defined (PATH_INDEX_THREADS)
+  index_stopping = 0;
+  if (pipe (wake_fds) == 0)
+    {
+      fcntl (wake_fds[0], F_SETFL, fcntl (wake_fds[0], F_GETFL, 0) | O_NONBLOCK);
+#  if defined (PATH_INDEX_INOTIFY)
+      inotify_fd = inotify_init1 (IN_NONBLOCK|IN_CLOEXEC);
+#  endif
+      if (pthread_create (&index_thread, (pthread_attr_t *)NULL, index_thread_main, (void *)NULL) == 0)
+	{
+	  index_threaded = 1;
+	  return 0;
+	}
+#  if defined (PATH_INDEX_INOTIFY)
+      if (inotify_fd >= 0)
+	close (inotify_fd);
+      inotify_fd = -1;
+#  endif
+      close (wake_fds[0]);
+      close (wake_fds[1]);
+      wake_fds[0] = wake_fds[1] = -1;
+    }
+#endif
+
+  /* No thread: index the tree now. */
+  if (load_index ())
+    publish_snapshot ();
+  update_index (2);
+  return 0;
+}
+
+/* Stop indexing and forget the index, after saving it if it's kept in a
+   file. */
+void
+rl_path_index_stop ()
+{
+  if (index_active == 0)
+    return;
+
+#if defined (PATH_INDEX_THREADS)
+  if (index_threaded)
+    {
+      index_stopping = 1;
+      /* If this fails, the thread sees index_stopping within
+	 INDEX_STOP_POLL seconds. */
+      while (write (wake_fds[1], "q", 1) < 0 && errno == EINTR)
+	;
+      pthread_join (index_thread, (void **)NULL);
+      index_threaded = 0;
+    }
+  if (wake_fds[0] >= 0)
+    {
+      close (wake_fds[0]);
+      close (wake_fds[1]);
+      wake_fds[0] = wake_fds[1] = -1;
+    }
+#endif
+
+  free_dirs ();
+
+#if defined (PATH_INDEX_INOTIFY)
+  if (inotify_fd >= 0)
+    close (inotify_fd);
+  inotify_fd = -1;
+  FREE (wd_dirs);
+  wd_dirs = (int *)NULL;
+  wd_dirs_size = 0;
+#endif
+
+  LOCK_INDEX ();
+  free_snapshot (snapshot);
+  snapshot = (INDEX_SNAPSHOT *)NULL;
+  UNLOCK_INDEX ();
+
+  FREE (index_root);
+  FREE (index_prefix);
+  FREE (index_file);
+  index_root = index_prefix = index_file = (char *)NULL;
+  index_active = 0;
+}
+
+/* Check every directory in the index for changes now.  With an indexing
+   thread, this just asks the thread to do it. */
+int
+rl_path_index_refresh ()
+{
+  if (index_active == 0)
+    return -1;
+
+#if defined (PATH_INDEX_THREADS)
+  if (index_threaded)
+    return (write (wake_fds[1], "r", 1) == 1 ? 0 : -1);
+#endif
+
+  update_index (2);
+  return 0;
+}
+
+/* A completion generator for pathnames anywhere in the tree given to
+   rl_path_index_start.  TEXT matches the pathnames with a component that
+   begins with it, so `comp' matches `lib/readline/complete.c' and
+   `readline/comp' does too.  The matches are relative to the current
+   directory.  TEXT that begins with `/', `~', `./' or `../', or is empty,
+   is completed by rl_filename_completion_function, as is everything until
+   the index has been read or built. */
+char *
+rl_indexed_path_completion_function (text, state)
+     const char *text;
+     int state;
+{
+  static char **paths = (char **)NULL;
+  static int npaths, path_index;
+  static int use_filenames;
+
+  if (state == 0)
+    {
+      if (paths)
+	{
+	  for ( ; path_index < npaths; path_index++)
+	    xfree (paths[path_index]);
+	  xfree (paths);
+	  paths = (char **)NULL;
+	}
+      npaths = path_index = 0;
+
+      /* The matches are filenames, so quote them and mark directories
+	 the way rl_filename_completion_function's would be. */
+      rl_filename_completion_desired = 1;
+
+#if !defined (PATH_INDEX_THREADS)
+      if (index_active && rl_path_index_interval > 0 &&
+	  time ((time_t *)NULL) - last_refresh >= rl_path_index_interval)
+	update_index (1);
+#endif
+
+      use_filenames = *text == '\0' || *text == '/' || *text == '~' ||
+		      (text[0] == '.' && (text[1] == '/' || (text[1] == '.' && text[2] == '/'))) ||
+		      (npaths = find_indexed_paths (text, &paths)) < 0;
+      if (use_filenames)
+	npaths = 0;
+      else
+	_rl_completion_nonprefix = 1;
+    }
+
+  if (use_filenames)
+    return (rl_filename_completion_function (text, state));
+
+  if (path_index < npaths)
+    return (paths[path_index++]);
+
+  FREE (paths);
+  paths = (char **)NULL;
+  npaths = path_index = 0;
+  return ((char *)NULL);
+}
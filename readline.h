@@ -222,6 +222,7 @@ extern void rl_callback_handler_install PARAMS((const char *, rl_vcpfunc_t *));
 extern void rl_callback_read_char PARAMS((void));
 extern void rl_callback_handler_remove PARAMS((void));
 extern void rl_callback_sigcleanup PARAMS((void));
+extern void rl_callback_read_completion PARAMS((void));
 
 /* Things for vi mode. Not available unless readline is compiled -DVI_MODE. */
 /* VI-mode bindable commands. */
@@ -482,9 +483,18 @@ extern int rl_complete_internal PARAMS((int));
 extern void rl_display_match_list PARAMS((char **, int, int));
 
 extern char **rl_completion_matches PARAMS((const char *, rl_compentry_func_t *));
+extern char **rl_completion_matches_batch PARAMS((const char *, rl_compentry_batch_func_t *));
+extern int rl_completion_async_fd PARAMS((void));
+extern int rl_completion_async_progress PARAMS((void));
 extern char *rl_username_completion_function PARAMS((const char *, int));
 extern char *rl_filename_completion_function PARAMS((const char *, int));
 
+/* Indexed pathname completion (pathindex.c). */
+extern int rl_path_index_start PARAMS((const char *, const char *));
+extern void rl_path_index_stop PARAMS((void));
+extern int rl_path_index_refresh PARAMS((void));
+extern char *rl_indexed_path_completion_function PARAMS((const char *, int));
+
 extern int rl_completion_mode PARAMS((rl_command_func_t *));
 
 #if 0
@@ -664,6 +674,21 @@ extern rl_compentry_func_t *rl_completion_entry_function;
    rl_completion_entry_function (rl_filename_completion_function). */
 extern rl_compentry_func_t *rl_menu_completion_entry_function;
 
+/* If non-zero, the completion entry function is monotonic, and readline
+   may narrow the previous list of matches when the user types more
+   characters instead of calling the function again.  Readline's own
+   generators are never treated as monotonic. */
+extern int rl_completion_entry_monotonic;
+
+/* The number of seconds between checks for changes to the directories in
+   the tree rl_path_index_start is indexing that can't be watched. */
+extern int rl_path_index_interval;
+
+/* If non-zero, and the application is using the callback interface,
+   completion matches are generated on a separate thread and inserted when
+   the application calls rl_callback_read_completion (). */
+extern int rl_completion_async;
+
 /* If rl_ignore_some_completions_function is non-NULL it is the address
    of a function to call after all of the possible matches have been
    generated, but before the actual completion is done to the input line.
@@ -812,6 +837,18 @@ extern int rl_completion_invoking_key;
    is sure she wants to see them all.  The default value is 100. */
 extern int rl_completion_query_items;
 
+/* If positive, completion keeps at most this many matches and only counts
+   the rest.  The default value is 0, meaning no limit. */
+extern int rl_completion_max_matches;
+
+/* The number of matches left out of the last list of matches generated
+   because of rl_completion_max_matches, summed over the lists asked for
+   by one call to rl_attempted_completion_function.  Duplicates aren't
+   removed from the matches left out, so this is an upper bound if the
+   generator can return the same match twice.  A display hook uses this
+   to say how many matches it wasn't given. */
+extern int rl_completion_matches_omitted;
+
 /* Character appended to completed words when at the end of the line.  The
    default is a space.  Nothing is added if this is '\0'. */
 extern int rl_completion_append_character;
@@ -68,6 +68,7 @@
 #define SF_FOUND		0x02
 #define SF_FAILED		0x04
 #define SF_CHGKMAP		0x08
+#define SF_REGEX		0x10
 
 typedef struct  __rl_search_context
 {
@@ -265,6 +266,9 @@ extern char *_rl_untranslate_macro_value PARAMS((char *, int));
 extern void _rl_reset_completion_state PARAMS((void));
 extern char _rl_find_completion_word PARAMS((int *, int *));
 extern void _rl_free_match_list PARAMS((char **));
+extern int _rl_complete_async_pending PARAMS((void));
+extern void _rl_complete_async_cancel PARAMS((void));
+extern int _rl_complete_async_finish PARAMS((void));
 
 /* display.c */
 extern char *_rl_strip_prompt PARAMS((char *));
@@ -416,6 +420,8 @@ extern int _rl_abort_internal PARAMS((void));
 extern int _rl_null_function PARAMS((int, int));
 extern char *_rl_strindex PARAMS((const char *, const char *));
 extern int _rl_qsort_string_compare PARAMS((char **, char **));
+extern void _rl_sort_string_array PARAMS((char **, int));
+extern void _rl_sort_strings_bytewise PARAMS((char **, int));
 extern int (_rl_uppercase_p) PARAMS((int));
 extern int (_rl_lowercase_p) PARAMS((int));
 extern int (_rl_pure_alphabetic) PARAMS((int));
@@ -456,8 +462,12 @@ extern int _rl_completion_columns;
 extern int _rl_print_completions_horizontally;
 extern int _rl_completion_case_fold;
 extern int _rl_completion_case_map;
+extern int _rl_fuzzy_completion;
+extern int _rl_completion_ranked;
+extern int _rl_completion_nonprefix;
 extern int _rl_match_hidden_files;
 extern int _rl_page_completions;
+extern int _rl_scroll_completions;
 extern int _rl_skip_completed_text;
 extern int _rl_menu_complete_prefix_first;
 
@@ -519,6 +529,7 @@ extern int _rl_executing_keyseq_size;
 
 /* search.c */
 extern _rl_search_cxt *_rl_nscxt;
+extern int _rl_noninc_search_regex;
 
 /* signals.c */
 extern int _rl_interrupt_immediately;
@@ -56,6 +56,7 @@ typedef int rl_command_func_t PARAMS((int, int));
 /* Typedefs for the completion system */
 typedef char *rl_compentry_func_t PARAMS((const char *, int));
 typedef char **rl_completion_func_t PARAMS((const char *, int, int));
+typedef char **rl_compentry_batch_func_t PARAMS((const char *, int));
 
 typedef char *rl_quote_func_t PARAMS((char *, int, char *));
 typedef char *rl_dequote_func_t PARAMS((char *, int));
@@ -55,6 +55,10 @@
 
 _rl_search_cxt *_rl_nscxt = 0;
 
+/* If non-zero, the non-incremental search commands treat the search string
+   as a POSIX extended regular expression. */
+int _rl_noninc_search_regex = 0;
+
 extern HIST_ENTRY *_rl_saved_line_for_history;
 
 /* Functions imported from the rest of the library. */
@@ -62,6 +66,7 @@ extern void _rl_free_history_entry PARAMS((HIST_ENTRY *));
 
 static char *noninc_search_string = (char *) NULL;
 static int noninc_history_pos;
+static int noninc_search_flags;
 
 static char *prev_line_found = (char *) NULL;
 
@@ -73,8 +78,8 @@ static char *history_search_string;
 static int history_string_size;
 
 static void make_history_line_current PARAMS((HIST_ENTRY *));
-static int noninc_search_from_pos PARAMS((char *, int, int));
-static int noninc_dosearch PARAMS((char *, int));
+static int noninc_search_from_pos PARAMS((char *, int, int, int));
+static int noninc_dosearch PARAMS((char *, int, int));
 static int noninc_search PARAMS((int, int));
 static int rl_history_search_internal PARAMS((int, int));
 static void rl_history_search_reinit PARAMS((int));
@@ -110,11 +115,12 @@ make_history_line_current (entry)
    POS.  If STRING begins with `^', the search must match STRING at the
    beginning of a history line, otherwise a full substring match is performed
    for STRING.  DIR < 0 means to search backwards through the history list,
-   DIR >= 0 means to search forward. */
+   DIR >= 0 means to search forward.  If FLAGS includes SF_REGEX, STRING is
+   a POSIX extended regular expression, which does its own anchoring. */
 static int
-noninc_search_from_pos (string, pos, dir)
+noninc_search_from_pos (string, pos, dir, flags)
      char *string;
-     int pos, dir;
+     int pos, dir, flags;
 {
   int ret, old;
 
@@ -126,7 +132,9 @@ noninc_search_from_pos (string, pos, dir)
     return -1;
 
   RL_SETSTATE(RL_STATE_SEARCH);
-  if (*string == '^')
+  if (flags & SF_REGEX)
+    ret = history_search_regex (string, dir);
+  else if (*string == '^')
     ret = history_search_prefix (string + 1, dir);
   else
     ret = history_search (string, dir);
@@ -141,11 +149,12 @@ noninc_search_from_pos (string, pos, dir)
 
 /* Search for a line in the history containing STRING.  If DIR is < 0, the
    search is backwards through previous entries, else through subsequent
-   entries.  Returns 1 if the search was successful, 0 otherwise. */
+   entries.  FLAGS is passed to noninc_search_from_pos.  Returns 1 if the
+   search was successful, 0 otherwise. */
 static int
-noninc_dosearch (string, dir)
+noninc_dosearch (string, dir, flags)
      char *string;
-     int dir;
+     int dir, flags;
 {
   int oldpos, pos;
   HIST_ENTRY *entry;
@@ -156,7 +165,7 @@ noninc_dosearch (string, dir)
       return 0;
     }
 
-  pos = noninc_search_from_pos (string, noninc_history_pos + dir, dir);
+  pos = noninc_search_from_pos (string, noninc_history_pos + dir, dir, flags);
   if (pos == -1)
     {
       /* Search failed, current history position unchanged. */
@@ -197,6 +206,8 @@ _rl_nsearch_init (dir, pchar)
   cxt = _rl_scxt_alloc (RL_SEARCH_NSEARCH, 0);
   if (dir < 0)
     cxt->sflags |= SF_REVERSE;		/* not strictly needed */
+  if (_rl_noninc_search_regex)
+    cxt->sflags |= SF_REGEX;
 
   cxt->direction = dir;
   cxt->history_pos = cxt->save_line;
@@ -330,6 +341,7 @@ _rl_nsearch_dosearch (cxt)
       noninc_history_pos = cxt->save_line;
       FREE (noninc_search_string);
       noninc_search_string = savestring (rl_line_buffer);
+      noninc_search_flags = cxt->sflags & SF_REGEX;
 
       /* If we don't want the subsequent undo list generated by the search
 	 matching a history line to include the contents of the search string,
@@ -340,7 +352,7 @@ _rl_nsearch_dosearch (cxt)
     }
 
   rl_restore_prompt ();
-  return (noninc_dosearch (noninc_search_string, cxt->direction));
+  return (noninc_dosearch (noninc_search_string, cxt->direction, noninc_search_flags));
 }
 
 /* Search non-interactively through the history list.  DIR < 0 means to
@@ -412,7 +424,7 @@ rl_noninc_forward_search_again (count, key)
       rl_ding ();
       return (1);
     }
-  r = noninc_dosearch (noninc_search_string, 1);
+  r = noninc_dosearch (noninc_search_string, 1, noninc_search_flags);
   return (r != 1);
 }
 
@@ -429,7 +441,7 @@ rl_noninc_reverse_search_again (count, key)
       rl_ding ();
       return (1);
     }
-  r = noninc_dosearch (noninc_search_string, -1);
+  r = noninc_dosearch (noninc_search_string, -1, noninc_search_flags);
   return (r != 1);
 }
 
@@ -469,7 +481,7 @@ rl_history_search_internal (count, dir)
   while (count)
     {
       RL_CHECK_SIGNALS ();
-      ret = noninc_search_from_pos (history_search_string, rl_history_search_pos + dir, dir);
+      ret = noninc_search_from_pos (history_search_string, rl_history_search_pos + dir, dir, 0);
       if (ret == -1)
 	break;
 
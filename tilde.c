@@ -46,6 +46,10 @@
 #if defined (HAVE_PWD_H)
 #include <pwd.h>
 #endif
+#include <time.h>
+#if defined (HAVE_PTHREAD_H) && defined (HAVE_PTHREAD_CREATE)
+#  include <pthread.h>
+#endif
 #if defined (_WIN32)
 #include <windows.h>
 #endif
@@ -67,6 +71,12 @@ extern struct passwd *getpwnam PARAMS((const char *));
 #  endif
 #endif /* !HAVE_GETPW_DECLS */
 
+/* Most systems don't declare getpwent in <pwd.h> if _POSIX_SOURCE is
+   defined. */
+#if defined (HAVE_GETPWENT) && (!defined (HAVE_GETPW_DECLS) || defined (_POSIX_SOURCE))
+extern struct passwd *getpwent PARAMS((void));
+#endif /* HAVE_GETPWENT && (!HAVE_GETPW_DECLS || _POSIX_SOURCE) */
+
 #if !defined (savestring)
 #define savestring(x) strcpy ((char *)xmalloc (1 + strlen (x)), (x))
 #endif /* !savestring */
@@ -119,11 +129,48 @@ char **tilde_additional_prefixes = (char **)default_prefixes;
    `:' and `=~'. */
 char **tilde_additional_suffixes = (char **)default_suffixes;
 
+/* The number of seconds we keep a copy of the password database to use
+   for completing usernames, and the home directories we looked up to
+   expand `~user', before asking the system again.  If zero, the default,
+   we don't keep anything, so new and changed accounts are seen at once;
+   if negative, we never ask again until tilde_clear_user_cache is
+   called. */
+int tilde_user_cache_timeout = 0;
+
+/* Readline can expand tildes on its completion thread while the
+   application expands them on another, so the caches, and the password
+   database functions that fill them, are only used with cache_lock
+   held. */
+#if defined (HAVE_PTHREAD_H) && defined (HAVE_PTHREAD_CREATE)
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+#  define LOCK_CACHE()		pthread_mutex_lock (&cache_lock)
+#  define UNLOCK_CACHE()	pthread_mutex_unlock (&cache_lock)
+#else
+#  define LOCK_CACHE()
+#  define UNLOCK_CACHE()
+#endif
+
 static int tilde_find_prefix PARAMS((const char *, int *));
 static int tilde_find_suffix PARAMS((const char *));
 static char *isolate_tilde_prefix PARAMS((const char *, int *));
 static char *glue_prefix_and_suffix PARAMS((char *, const char *, int));
 
+#if defined (HAVE_GETPWENT) || defined (HAVE_GETPWNAM)
+static int cache_time_valid PARAMS((time_t));
+#endif
+#if defined (HAVE_GETPWENT)
+static int user_entry_compare PARAMS((const void *, const void *));
+static void clear_user_list PARAMS((void));
+static void read_user_cache PARAMS((void));
+static int user_cache_valid PARAMS((void));
+static int find_first_user PARAMS((const char *, int));
+#endif
+#if defined (HAVE_GETPWNAM)
+static unsigned int home_hash PARAMS((const char *));
+static void clear_home_cache PARAMS((void));
+static char *lookup_user_home PARAMS((const char *));
+#endif
+
 /* Find the start of a tilde expansion in STRING, and return the index of
    the tilde which starts the expansion.  Place the length of the text
    which identified this tilde starter in LEN, excluding the tilde itself. */
@@ -190,6 +237,312 @@ tilde_find_suffix (string)
   return (i);
 }
 
+#if defined (HAVE_GETPWENT) || defined (HAVE_GETPWNAM)
+/* Return non-zero if something we got from the password database at
+   time T is still good, according to tilde_user_cache_timeout. */
+static int
+cache_time_valid (t)
+     time_t t;
+{
+  time_t now;
+
+  if (tilde_user_cache_timeout < 0)
+    return 1;
+  now = time ((time_t *)NULL);
+  return (now >= t && now - t < tilde_user_cache_timeout);
+}
+#endif
+
+/* A copy of the names and home directories of the users in the password
+   database, sorted by name, so we can complete usernames without asking
+   the system each time.  With a network user database that can be
+   slow. */
+#if defined (HAVE_GETPWENT)
+struct user_entry {
+  char *name;
+  char *dir;
+  int order;
+};
+
+static char **user_names = (char **)NULL;
+static char **user_dirs = (char **)NULL;
+static int user_count = 0;
+static int user_cache_read = 0;
+static time_t user_cache_time;
+
+/* Sort users by name; if a name appears more than once, the entry the
+   system returned first sorts first, since that's what getpwnam finds. */
+static int
+user_entry_compare (a, b)
+     const void *a, *b;
+{
+  const struct user_entry *ua, *ub;
+  int r;
+
+  ua = (const struct user_entry *)a;
+  ub = (const struct user_entry *)b;
+  r = strcmp (ua->name, ub->name);
+  return (r ? r : ua->order - ub->order);
+}
+
+static void
+clear_user_list ()
+{
+  int i;
+
+  for (i = 0; i < user_count; i++)
+    {
+      xfree (user_names[i]);
+      xfree (user_dirs[i]);
+    }
+  if (user_names)
+    xfree (user_names);
+  if (user_dirs)
+    xfree (user_dirs);
+  user_names = user_dirs = (char **)NULL;
+  user_count = 0;
+  user_cache_read = 0;
+}
+
+/* Read the password database into USER_NAMES and USER_DIRS.  Called with
+   cache_lock held. */
+static void
+read_user_cache ()
+{
+  struct passwd *entry;
+  struct user_entry *users;
+  int i, n, size;
+
+  clear_user_list ();
+
+  users = (struct user_entry *)NULL;
+  n = size = 0;
+  setpwent ();
+  while ((entry = getpwent ()) != 0)
+    {
+      if (n == size)
+	{
+	  size = size ? size * 2 : 64;
+	  users = (struct user_entry *)xrealloc (users, size * sizeof (struct user_entry));
+	}
+      users[n].name = savestring (entry->pw_name);
+      users[n].dir = savestring (entry->pw_dir ? entry->pw_dir : "");
+      users[n].order = n;
+      n++;
+    }
+  endpwent ();
+
+  if (n > 1)
+    qsort (users, n, sizeof (struct user_entry), user_entry_compare);
+
+  user_names = (char **)xmalloc ((n + 1) * sizeof (char *));
+  user_dirs = (char **)xmalloc ((n + 1) * sizeof (char *));
+  for (i = user_count = 0; i < n; i++)
+    {
+      if (user_count && strcmp (users[i].name, user_names[user_count - 1]) == 0)
+	{
+	  xfree (users[i].name);
+	  xfree (users[i].dir);
+	  continue;
+	}
+      user_names[user_count] = users[i].name;
+      user_dirs[user_count] = users[i].dir;
+      user_count++;
+    }
+  user_names[user_count] = user_dirs[user_count] = (char *)NULL;
+  if (users)
+    xfree (users);
+
+  user_cache_read = 1;
+  user_cache_time = time ((time_t *)NULL);
+}
+
+/* Return non-zero if the copy of the password database may be used. */
+static int
+user_cache_valid ()
+{
+  return (user_cache_read && cache_time_valid (user_cache_time));
+}
+
+/* Return the index of the first cached user whose name begins with the
+   LEN characters of PREFIX, or USER_COUNT if there is none. */
+static int
+find_first_user (prefix, len)
+     const char *prefix;
+     int len;
+{
+  int lo, hi, mid;
+
+  lo = 0;
+  hi = user_count;
+  while (lo < hi)
+    {
+      mid = lo + (hi - lo) / 2;
+      if (strncmp (user_names[mid], prefix, len) < 0)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+  return lo;
+}
+
+#endif /* HAVE_GETPWENT */
+
+#if defined (HAVE_GETPWNAM)
+/* What getpwnam said about the users we expanded `~user' for, including
+   the ones it didn't find, so expanding the same name again doesn't ask
+   the system.  Looking up one user is all expansion needs, and some
+   user databases (LDAP without enumeration, for instance) can look up
+   users getpwent never lists. */
+struct home_entry {
+  struct home_entry *next;
+  char *name;
+  char *dir;		/* NULL if there is no such user */
+  time_t time;
+};
+
+#define HOME_CACHE_BUCKETS	64
+#define HOME_CACHE_MAX		512	/* start over when there are this many */
+
+static struct home_entry *home_cache[HOME_CACHE_BUCKETS];
+static int home_cache_count = 0;
+
+static unsigned int
+home_hash (name)
+     const char *name;
+{
+  unsigned int h;
+
+  for (h = 2166136261U; *name; name++)
+    h = (h ^ (unsigned char)*name) * 16777619U;
+  return (h % HOME_CACHE_BUCKETS);
+}
+
+static void
+clear_home_cache ()
+{
+  struct home_entry *e, *next;
+  int i;
+
+  for (i = 0; i < HOME_CACHE_BUCKETS; i++)
+    {
+      for (e = home_cache[i]; e; e = next)
+	{
+	  next = e->next;
+	  xfree (e->name);
+	  if (e->dir)
+	    xfree (e->dir);
+	  xfree (e);
+	}
+      home_cache[i] = (struct home_entry *)NULL;
+    }
+  home_cache_count = 0;
+}
+
+/* Return a new string which is the home directory of USERNAME, or NULL
+   if there is no such user. */
+static char *
+lookup_user_home (username)
+     const char *username;
+{
+  struct home_entry *e, **ep;
+  struct passwd *entry;
+  unsigned int h;
+  char *dir;
+
+  LOCK_CACHE ();
+  if (tilde_user_cache_timeout == 0)
+    {
+      entry = getpwnam (username);
+      dir = (entry && entry->pw_dir) ? savestring (entry->pw_dir) : (char *)NULL;
+      UNLOCK_CACHE ();
+      return (dir);
+    }
+
+  h = home_hash (username);
+  for (ep = &home_cache[h]; (e = *ep); ep = &e->next)
+    if (strcmp (e->name, username) == 0)
+      break;
+
+  if (e && cache_time_valid (e->time))
+    {
+      dir = e->dir ? savestring (e->dir) : (char *)NULL;
+      UNLOCK_CACHE ();
+      return (dir);
+    }
+
+  if (e)
+    {
+      /* Out of date; look the user up again. */
+      *ep = e->next;
+      xfree (e->name);
+      if (e->dir)
+	xfree (e->dir);
+      xfree (e);
+      home_cache_count--;
+    }
+  else if (home_cache_count >= HOME_CACHE_MAX)
+    clear_home_cache ();
+
+  entry = getpwnam (username);
+  e = (struct home_entry *)xmalloc (sizeof (struct home_entry));
+  e->name = savestring (username);
+  e->dir = (entry && entry->pw_dir) ? savestring (entry->pw_dir) : (char *)NULL;
+  e->time = time ((time_t *)NULL);
+  e->next = home_cache[h];
+  home_cache[h] = e;
+  home_cache_count++;
+  dir = e->dir ? savestring (e->dir) : (char *)NULL;
+  UNLOCK_CACHE ();
+  return (dir);
+}
+#endif /* HAVE_GETPWNAM */
+
+/* Discard the copy of the password database and the home directories
+   we looked up, so the next expansion or username completion asks the
+   system again. */
+void
+tilde_clear_user_cache ()
+{
+  LOCK_CACHE ();
+#if defined (HAVE_GETPWNAM)
+  clear_home_cache ();
+#endif
+#if defined (HAVE_GETPWENT)
+  clear_user_list ();
+#endif
+  UNLOCK_CACHE ();
+}
+
+/* Find the users whose names begin with the LEN characters of PREFIX.
+   Return the number of them and set *NAMESP to a sorted array of their
+   names, which stays valid until the password database is read again
+   by another call to a tilde function. */
+int
+tilde_find_users (prefix, len, namesp)
+     const char *prefix;
+     int len;
+     char ***namesp;
+{
+#if defined (HAVE_GETPWENT)
+  int first, last;
+
+  LOCK_CACHE ();
+  if (tilde_user_cache_timeout == 0 || user_cache_valid () == 0)
+    read_user_cache ();
+
+  first = find_first_user (prefix, len);
+  for (last = first; last < user_count && strncmp (user_names[last], prefix, len) == 0; last++)
+    ;
+  *namesp = user_names + first;
+  UNLOCK_CACHE ();
+  return (last - first);
+#else
+  *namesp = (char **)NULL;
+  return 0;
+#endif
+}
+
 /* Return a new string which is the result of tilde expanding STRING. */
 char *
 tilde_expand (string)
@@ -352,9 +705,7 @@ tilde_expand_word (filename)
 {
   char *dirname, *expansion, *username;
   int user_len;
-#if !defined (_WIN32)
-  struct passwd *user_entry;
-#else /* _WIN32 */
+#if defined (_WIN32)
   char UserName[256];
   DWORD UserLen = 256;
 #endif /* _WIN32 */
@@ -403,12 +754,16 @@ tilde_expand_word (filename)
      password database. */
   dirname = (char *)NULL;
 #if !defined (_WIN32)
+  expansion = (char *)NULL;
 #if defined (HAVE_GETPWNAM)
-  user_entry = getpwnam (username);
-#else
-  user_entry = 0;
+  expansion = lookup_user_home (username);
 #endif
-  if (user_entry == 0)
+  if (expansion)
+    {
+      dirname = glue_prefix_and_suffix (expansion, filename, user_len);
+      xfree (expansion);
+    }
+  else
     {
       /* If the calling program has a special syntax for expanding tildes,
 	 and we couldn't find a standard expansion, then let them try. */
@@ -426,14 +781,12 @@ tilde_expand_word (filename)
       if (dirname == 0)
 	dirname = savestring (filename);
     }
-#if defined (HAVE_GETPWENT)
-  else
-    dirname = glue_prefix_and_suffix (user_entry->pw_dir, filename, user_len);
-#endif
 
   xfree (username);
 #if defined (HAVE_GETPWENT)
+  LOCK_CACHE ();
   endpwent ();
+  UNLOCK_CACHE ();
 #endif
 #else /* _WIN32 */
   if (GetUserNameA (UserName, &UserLen))
@@ -63,6 +63,13 @@ extern char **tilde_additional_prefixes;
    `:' and `=~'. */
 extern char **tilde_additional_suffixes;
 
+/* The number of seconds a copy of the password database is kept for
+   completing usernames, and the home directories (or the absence of one)
+   found for expanding `~user' are remembered, before the system is asked
+   again.  Zero, the default, means never keep anything; a negative value
+   means keep it until tilde_clear_user_cache is called. */
+extern int tilde_user_cache_timeout;
+
 /* Return a new string which is the result of tilde expanding STRING. */
 extern char *tilde_expand PARAMS((const char *));
 
@@ -73,6 +80,15 @@ extern char *tilde_expand_word PARAMS((const char *));
 /* Find the portion of the string beginning with ~ that should be expanded. */
 extern char *tilde_find_word PARAMS((const char *, int, int *));
 
+/* Find the users whose names begin with the first LEN characters of
+   PREFIX.  Return the number of them and set the third argument to a
+   sorted array of their names, valid until the next tilde function call. */
+extern int tilde_find_users PARAMS((const char *, int, char ***));
+
+/* Discard the saved copy of the password database and the saved home
+   directories. */
+extern void tilde_clear_user_cache PARAMS((void));
+
 #ifdef __cplusplus
 }
 #endif
@@ -42,6 +42,10 @@
 #include <stdio.h>
 #include <ctype.h>
 
+#if defined (HAVE_LOCALE_H)
+#  include <locale.h>
+#endif
+
 /* System-specific feature definitions and include files. */
 #include "rldefs.h"
 #include "rlmbutil.h"
@@ -57,6 +61,12 @@
 #include "xmalloc.h"
 #include "rlshell.h"
 
+#ifdef __STDC__
+typedef int QSFUNC (const void *, const void *);
+#else
+typedef int QSFUNC ();
+#endif
+
 /* **************************************************************** */
 /*								    */
 /*			Utility Functions			    */
@@ -447,6 +457,124 @@ _rl_qsort_string_compare (s1, s2)
 #endif
 }
 
+/* Return non-zero if _rl_qsort_string_compare orders strings by their
+   bytes in the current locale, so a byte-wise sort gives the same
+   result. */
+static int
+string_compare_is_bytewise ()
+{
+#if defined (HAVE_STRCOLL) && defined (HAVE_SETLOCALE)
+  char *lspec;
+
+  lspec = setlocale (LC_COLLATE, (char *)NULL);
+  return (lspec == 0 || STREQ (lspec, "C") || STREQ (lspec, "POSIX") ||
+	  (lspec[0] == 'C' && lspec[1] == '.'));
+#elif defined (HAVE_STRCOLL)
+  return 0;
+#else
+  return 1;
+#endif
+}
+
+/* Below this many strings, radix_sort_strings uses an insertion sort. */
+#define RADIX_SORT_THRESHOLD	32
+
+/* Sort the N strings in A by their bytes, starting at offset DEPTH, where
+   all of the strings are known to have the same first DEPTH bytes.  TMP
+   and KEYS are scratch space for at least N entries.  This is an MSD
+   radix sort: it distributes the strings into buckets by the byte at
+   DEPTH, then sorts each bucket by the following bytes.  Only the smaller
+   buckets are sorted recursively, which bounds the recursion depth. */
+static void
+radix_sort_strings (a, tmp, keys, n, depth)
+     char **a, **tmp;
+     unsigned char *keys;
+     int n, depth;
+{
+  int count[256], pos[256];
+  register int i, j, c;
+  int big;
+  char *t;
+
+  while (n > RADIX_SORT_THRESHOLD)
+    {
+      memset (count, 0, sizeof (count));
+      for (i = 0; i < n; i++)
+	count[keys[i] = (unsigned char)a[i][depth]]++;
+
+      /* Strings in bucket 0 have ended, so they're all equal. */
+      if (count[0] == n)
+	return;
+      else if (count[keys[0]] == n)
+	{
+	  depth++;
+	  continue;
+	}
+
+      for (c = 1, pos[0] = 0; c < 256; c++)
+	pos[c] = pos[c - 1] + count[c - 1];
+      for (i = 0; i < n; i++)
+	tmp[pos[keys[i]]++] = a[i];
+      memcpy (a, tmp, n * sizeof (char *));
+
+      for (c = big = 1; c < 256; c++)
+	if (count[c] > count[big])
+	  big = c;
+      for (c = 1, i = count[0]; c < 256; i += count[c++])
+	if (c != big && count[c] > 1)
+	  radix_sort_strings (a + i, tmp, keys, count[c], depth + 1);
+
+      a += pos[big] - count[big];
+      n = count[big];
+      depth++;
+    }
+
+  for (i = 1; i < n; i++)
+    {
+      t = a[i];
+      for (j = i; j > 0 && strcmp (a[j - 1] + depth, t + depth) > 0; j--)
+	a[j] = a[j - 1];
+      a[j] = t;
+    }
+}
+
+/* Sort the N strings in ARRAY the same way qsort would using
+   _rl_qsort_string_compare.  When the locale doesn't require strcoll,
+   this uses a radix sort on the strings' bytes, which is much faster for
+   large arrays. */
+void
+_rl_sort_string_array (array, n)
+     char **array;
+     int n;
+{
+  if (n < 2)
+    return;
+  if (string_compare_is_bytewise ())
+    _rl_sort_strings_bytewise (array, n);
+  else
+    qsort (array, n, sizeof (char *), (QSFUNC *)_rl_qsort_string_compare);
+}
+
+/* Sort the N strings in ARRAY by their bytes, as strcmp would, regardless
+   of the locale. */
+void
+_rl_sort_strings_bytewise (array, n)
+     char **array;
+     int n;
+{
+  char **tmp;
+  unsigned char *keys;
+
+  if (n < 2)
+    return;
+
+  tmp = (char **)xmalloc (n * sizeof (char *));
+  keys = (unsigned char *)xmalloc (n);
+  radix_sort_strings (array, tmp, keys, n, 0);
+  xfree (keys);
+  xfree (tmp);
+}
+
 /* Function equivalents for the macros defined in chardefs.h. */
 #define FUNCTION_FOR_MACRO(f)	int (f) (c) int c; { return f (c); }
 